@@ -60,6 +60,8 @@ int prog_size_bytes=0;
 int prog_size_instr=0;
 unsigned char *instr_mem=0;
 unsigned int prog_entry_point=0;
+unsigned *elf_leaders=0;        //!< Code symbols of the ELF file (block leaders)
+int elf_leaders_num=0;
 extern char *project_name;
 extern ac_decoder_full *decoder;
 extern int ACABIFlag;
@@ -76,6 +78,11 @@ extern char* eval_input;
 //Prototype
 ac_sto_list *accs_FindLoadDevice();
 int eval_parse (void);
+void accs_ReadElfSymbols(int fd, Elf32_Ehdr *ehdr);
+int  accs_MarkLeader(unsigned addr);
+int  accs_CommitFile(char *tmpname, char *filename);
+void accs_EmitMidBlockInstrs(FILE *output, int start, int end, int syscall_end);
+void accs_EmitCString(FILE *output, char *str);
 
 
 /*************************************************************************************/
@@ -203,8 +210,8 @@ int accs_main()
     exit(EXIT_FAILURE);
   }
 
-  //Test if the optimization required is available
-  if (PROCESSOR_OPTIMIZATIONS > ControlInstrInfoLevel) {
+  //Test if the optimization required is available (3 needs the same information as 2)
+  if (((PROCESSOR_OPTIMIZATIONS == 3) ? 2 : PROCESSOR_OPTIMIZATIONS) > ControlInstrInfoLevel) {
     PROCESSOR_OPTIMIZATIONS = ControlInstrInfoLevel;
     AC_MSG("WARNING: falling down to optimization level %d due to lack of information in the model.\n", PROCESSOR_OPTIMIZATIONS);
   }
@@ -571,8 +578,8 @@ int ac_load_elf(char* filename, char* data_mem, unsigned int data_mem_size)
   }
   if (prog_size_bytes == 0) prog_size_bytes = data_mem_size;
 
-
-
+  //Code symbols are block leaders (optimization level 3)
+  accs_ReadElfSymbols(fd, &ehdr);
 
   //Close file
   close(fd);
@@ -581,6 +588,38 @@ int ac_load_elf(char* filename, char* data_mem, unsigned int data_mem_size)
 }
 
 
+//Collect the addresses of code symbols (functions and labels) in elf_leaders
+void accs_ReadElfSymbols(int fd, Elf32_Ehdr *ehdr)
+{
+  Elf32_Shdr shdr;
+  Elf32_Sym  sym;
+  unsigned int i, k;
+
+  for (i=0; i<convert_endian(2,ehdr->e_shnum); i++) {
+
+    lseek(fd, convert_endian(4,ehdr->e_shoff) + convert_endian(2,ehdr->e_shentsize) * i, SEEK_SET);
+    if ((read(fd, &shdr, sizeof(shdr)) != sizeof(shdr)) ||
+        (convert_endian(4,shdr.sh_type) != SHT_SYMTAB))
+      continue;
+
+    unsigned int nsyms = convert_endian(4,shdr.sh_size) / sizeof(Elf32_Sym);
+    elf_leaders = (unsigned *) realloc(elf_leaders, sizeof(unsigned) * (elf_leaders_num + nsyms));
+
+    lseek(fd, convert_endian(4,shdr.sh_offset), SEEK_SET);
+    for (k=0; k<nsyms; k++) {
+      if (read(fd, &sym, sizeof(sym)) != sizeof(sym))
+        break;
+      int type = ELF32_ST_TYPE(sym.st_info);
+      unsigned value = convert_endian(4,sym.st_value);
+      if (((type == STT_FUNC) || (type == STT_NOTYPE)) &&
+          (convert_endian(2,sym.st_shndx) != SHN_UNDEF) &&
+          (value < (unsigned) prog_size_bytes))
+        elf_leaders[elf_leaders_num++] = value;
+    }
+  }
+}
+
+
 int accs_ReadHexProgram(char* prog_filename)
 {
   FILE *prog;
@@ -961,12 +1000,21 @@ void accs_CreateCompsimHeader()
 	  "	void set_pc(unsigned val);\n"
 	  "	void set_return(unsigned val);\n"
 	  "	unsigned get_return();\n"
-	  "	int *get_syscall_table();\n");
+	  "	int *get_syscall_table();\n"
+	  "	// Syscall results are not recorded in compiled simulation, and\n"
+	  "	// there is no virtual time\n"
+	  "	bool replay_sysc(int location) { return false; }\n"
+	  "	bool replay_console_write() { return false; }\n"
+	  "	bool virtual_time(struct timespec *ts, bool wall) { return false; }\n"
+	  "	void out_int(int argn, int val) { set_int(argn, val); }\n"
+	  "	void out_buffer(int argn, unsigned char* buf, unsigned int size) { set_buffer(argn, buf, size); }\n");
 	  //"	int process_syscall(int syscall);");
 
   for (j=0; j <= ((prog_size_bytes-1) >> REGION_SIZE); j++) {
     fprintf(output, "	void Region%d();\n" , j);
   }
+  if (PROCESSOR_OPTIMIZATIONS == 3)
+    fprintf(output, "	void MidBlockEntry(unsigned pc);\n");
 
   fprintf( output, "\n");
 
@@ -1050,9 +1098,12 @@ void accs_CreateCompsimImpl()
   extern int ACABIFlag;
 
   char filename[256];
+  char tmpname[260];
   FILE *output;
   int i,j, next_instr, rblock;
   int invalid_instr_count = 0;
+  int changed_files = 0;
+  int syscall_end = 0;
   int *stat_instr_used = (int *) calloc(instr_num+1, sizeof(int));
   //char *instr_mem_p;
   //char **instr_name;                //!< Instruction name table
@@ -1148,6 +1199,21 @@ void accs_CreateCompsimImpl()
   AC_MSG("Application size: %u bytes, %u instructions.\n", prog_size_bytes, prog_size_instr);
 
 
+  //Find more leaders: targets of indirect jumps (for opt3 optimization)
+  if (PROCESSOR_OPTIMIZATIONS == 3) {
+    int sym_leaders = 0, ptr_leaders = 0;
+
+    //functions and labels of the symbol table
+    for (j=0; j<elf_leaders_num; j++)
+      sym_leaders += accs_MarkLeader(elf_leaders[j]);
+
+    //code addresses stored in memory (jump tables, function pointers, return addresses)
+    for (j=0; (j+4 <= (int) ac_heap_ptr) && (j+4 <= (int) data_mem_size); j+=4)
+      ptr_leaders += accs_MarkLeader(convert_endian(4, *(unsigned int *) (instr_mem + j)));
+
+    AC_MSG("Block leaders: %d from ELF symbols, %d from code addresses in memory.\n", sym_leaders, ptr_leaders);
+  }
+
   //Load more leaders from file if file exists (for opt3 optimization)
   if (PROCESSOR_OPTIMIZATIONS == 3) {
     extern char *ACCompsimProg;
@@ -1180,11 +1246,12 @@ void accs_CreateCompsimImpl()
   //  select number of Regions per file with command-line option "-bs"
   for (rblock=0; rblock <= (((prog_size_bytes-1) >> REGION_SIZE) / REGION_BLOCK_SIZE); rblock++) {
 
-    // Open file
+    // Open file (written aside, see accs_CommitFile)
     if (rblock == 0) sprintf( filename, "%s.cpp", project_name);
     else             sprintf( filename, "%s-block%d.cpp", project_name, rblock);
+    sprintf( tmpname, "%s.tmp", filename);
 
-    if ( !(output = fopen( filename, "w"))){
+    if ( !(output = fopen( tmpname, "w"))){
       perror("ArchC could not open output file");
       exit(1);
     }
@@ -1205,6 +1272,9 @@ void accs_CreateCompsimImpl()
       fprintf( output, "#include \"ac_prog_regions.H\"\n");
     }
 
+    if (PROCESSOR_OPTIMIZATIONS == 3)
+      fprintf( output, "#include <fstream>\n#include <set>\n");
+
     fprintf( output, "\n");
 //    fprintf( output, "#define AC_ERROR( msg )    std::cerr<< \"ArchC ERROR: \" << msg  <<'\\n'\n");
 //    fprintf( output, "#define AC_SAY( msg )      std::cerr<< \"ArchC: \" << msg  <<'\\n'\n");
@@ -1279,7 +1349,7 @@ void accs_CreateCompsimImpl()
       for (j = (i << REGION_SIZE); j < end_region; j++) {
 
         if ((ACABIFlag) && (j==60)) {  // Special addresses for ArchC system calls
-          j = accs_EmitSyscalls(output, j);
+          j = syscall_end = accs_EmitSyscalls(output, j);
         }
 
         if ((decode_table[j]) && (decode_table[j]->dec_vector)) {
@@ -1306,6 +1376,19 @@ void accs_CreateCompsimImpl()
       if ((PROCESSOR_OPTIMIZATIONS)&&(ACMulticoreFlag==1)) 
       	fprintf( output, "      old_pc = ac_pc;\n");
       if (i == EXIT_ADDRESS>>REGION_SIZE) fprintf( output, "      if (ac_pc == %d) return;\n", EXIT_ADDRESS);
+      if (PROCESSOR_OPTIMIZATIONS == 3) {
+        //an indirect jump reached the middle of a block: run it instruction
+        //by instruction up to the next leader
+        fprintf( output,
+                 "      if ((ac_pc >= %d) && (ac_pc < %d)) {\n"
+                 "        MidBlockEntry(ac_pc);\n"
+                 "        switch((int)ac_pc) {\n"
+                 , (i << REGION_SIZE), ((i+1) << REGION_SIZE));
+        accs_EmitMidBlockInstrs(output, (i << REGION_SIZE), end_region, syscall_end);
+        fprintf( output,
+                 "        }\n"
+                 "      }\n");
+      }
       fprintf( output,
                "      if ((ac_pc >= %d) && (ac_pc < %d)) {\n"
                "        AC_ERROR(\"ac_pc=0x\" << hex << int(ac_pc) << \" points to an non-decoded memory location.\" << endl);\n"
@@ -1360,6 +1443,23 @@ void accs_CreateCompsimImpl()
               "\n"
               );
 
+	if (PROCESSOR_OPTIMIZATIONS == 3) {
+	  fprintf(output,
+	          "//An indirect jump reached the middle of a block: the address is\n"
+	          "//added to the leaders file (once) for the next accsim run\n"
+	          "void %s::MidBlockEntry(unsigned pc) {\n"
+	          "  static std::set<unsigned> seen;\n"
+	          "  if (!seen.insert(pc).second)\n"
+	          "    return;\n"
+	          "  const char *name = ", project_name);
+	  accs_EmitCString(output, ACCompsimProg);
+	  fprintf(output, " \".leaders\";\n"
+	          "  std::ofstream leaders(name, std::ios::app);\n"
+	          "  leaders << hex << pc << endl;\n"
+	          "  AC_WARN(\"ac_pc=0x\" << hex << pc << \" is not a known block leader; it runs interpreted and was added to \" << name);\n"
+	          "}\n\n");
+	}
+
 	fprintf(output, "#include <ac_sighandlers.H>\n\n");	
       	fprintf(output, "void %s::init(int ac, char **av){\n", project_name);
       	fprintf(output, "	this->ac = ac;\n");
@@ -2231,9 +2331,19 @@ fprintf( output,
 
     // Close file
     fclose( output);
+    changed_files += accs_CommitFile(tmpname, filename);
 
   }
 
+  AC_MSG("%d of %d compiled simulation files changed.\n", changed_files, rblock);
+
+  // Remove blocks left by a larger program
+  for (; ; rblock++) {
+    sprintf( filename, "%s-block%d.cpp", project_name, rblock);
+    if (remove(filename) != 0)
+      break;
+  }
+
 
   // Free memory
   for (j=0; j<prog_size_bytes; j++) {free(decode_table[j]);}
@@ -2248,7 +2358,7 @@ void accs_CreateCompsimHeaderRegions()
   int i;
   FILE *output;
 
-  if ( !(output = fopen("ac_prog_regions.H", "w"))){
+  if ( !(output = fopen("ac_prog_regions.H.tmp", "w"))){
     perror("ArchC could not open output file");
     exit(1);
   }
@@ -2260,6 +2370,7 @@ void accs_CreateCompsimHeaderRegions()
   }
 
   fclose( output); 
+  accs_CommitFile("ac_prog_regions.H.tmp", "ac_prog_regions.H");
 }
 
 
@@ -3853,8 +3964,8 @@ void accs_EmitMakefileExtra(FILE* output)
   fprintf( output, "\n");
 
   fprintf( output, "INLINE := %d\n", (ACInlineFlag?1:0));
-  fprintf( output, "ISA_AND_SYSCALL_TOGETHER := %d\n", (ACInlineFlag || PROCESSOR_OPTIMIZATIONS == 2)? 1 : 0);
-  if (PROCESSOR_OPTIMIZATIONS==2)
+  fprintf( output, "ISA_AND_SYSCALL_TOGETHER := %d\n", (ACInlineFlag || PROCESSOR_OPTIMIZATIONS >= 2)? 1 : 0);
+  if (PROCESSOR_OPTIMIZATIONS>=2)
   	fprintf( output, "CFLAGS := $(CFLAGS) $(if $(filter 1,$(INLINE)),-O3 -finline-functions -fgcse) $(if $(filter 1,$(ISA_AND_SYSCALL_TOGETHER)), -DAC_INLINE) ");
   else	
   	fprintf( output, "CFLAGS := $(CFLAGS) $(if $(filter 1,$(INLINE)),-O -finline-functions -fgcse) $(if $(filter 1,$(ISA_AND_SYSCALL_TOGETHER)), -DAC_INLINE) ");
@@ -3872,6 +3983,109 @@ void accs_EmitParmsExtra(FILE* output)
 }
 
 
+//Whether two files have the same contents; false if one cannot be read
+static int accs_SameFile(char *name1, char *name2)
+{
+  unsigned char buf1[4096], buf2[4096];
+  size_t n1, n2;
+  int same = 0;
+  FILE *f1, *f2;
+
+  if (!(f1 = fopen(name1, "rb")))
+    return 0;
+  if (!(f2 = fopen(name2, "rb"))) {
+    fclose(f1);
+    return 0;
+  }
+  do {
+    n1 = fread(buf1, 1, sizeof(buf1), f1);
+    n2 = fread(buf2, 1, sizeof(buf2), f2);
+    if ((n1 != n2) || memcmp(buf1, buf2, n1))
+      break;
+    same = (n1 == 0);
+  } while (!same);
+  fclose(f1);
+  fclose(f2);
+  return same;
+}
+
+
+//Moves the newly generated 'tmpname' over 'filename' only if the contents
+//differ, so unchanged files keep their timestamps and make does not
+//recompile them. Returns 1 if 'filename' was changed.
+int accs_CommitFile(char *tmpname, char *filename)
+{
+  if (accs_SameFile(tmpname, filename)) {
+    remove(tmpname);
+    return 0;
+  }
+
+  if (rename(tmpname, filename) != 0) {
+    perror("ArchC could not write output file");
+    exit(1);
+  }
+  return 1;
+}
+
+
+//Emits the instructions of [start, end) that are not leaders, one case
+//each, for the entries in the middle of a block (optimization level 3).
+//Each one runs alone and goes back to the switch of its Region, which
+//resumes compiled code at the next leader.
+void accs_EmitMidBlockInstrs(FILE *output, int start, int end, int syscall_end)
+{
+  extern int ACABIFlag;
+  ac_dec_instr *pinstr;
+  int j;
+
+  for (j = start; j < end; j++) {
+    if ((ACABIFlag) && (j==60))  // Special addresses for ArchC system calls
+      j = syscall_end;
+    if (!decode_table[j] || !decode_table[j]->dec_vector || decode_table[j]->is_leader)
+      continue;
+
+    pinstr = GetInstrByID(decoder->instructions, decode_table[j]->dec_vector[0]);
+    accs_Fields2Str(decode_table[j]);
+    fprintf( output, "        case 0x%x:\n", j);
+    accs_EmitInstrExtraTop(output, j, pinstr, 10);
+    accs_EmitInstrBehavior(output, j, pinstr, 10);
+    accs_EmitInstrExtraBottom(output, j, pinstr, 10);
+    if (ACMulticoreFlag == 1) {
+      fprintf( output, "          ac_instr_counter++;\n");
+      fprintf( output, "          old_pc = ac_pc;\n");
+    }
+    fprintf( output, "          continue;\n");
+  }
+}
+
+
+//Emits 'str' as a C string literal
+void accs_EmitCString(FILE *output, char *str)
+{
+  fputc('"', output);
+  for (; *str; str++) {
+    if ((*str == '"') || (*str == '\\'))
+      fprintf(output, "\\%c", *str);
+    else if ((unsigned char) *str < ' ')
+      fprintf(output, "\\%03o", (unsigned char) *str);
+    else
+      fputc(*str, output);
+  }
+  fputc('"', output);
+}
+
+
+//Marks a decoded instruction as block leader; returns 1 if it was not one
+int accs_MarkLeader(unsigned addr)
+{
+  if ((addr >= (unsigned) prog_size_bytes) || !decode_table[addr] ||
+      !decode_table[addr]->dec_vector || decode_table[addr]->is_leader)
+    return 0;
+  decode_table[addr]->is_leader = 0xFFFFFFFF;
+  return 1;
+}
+
+
 ac_sto_list *accs_FindLoadDevice()
 {
   //Already set?
@@ -302,14 +302,14 @@ int main( argc, argv )
               if ((argc < 2) || (argv[1][0] < '0') || (argv[1][0] > '9')) {
 /*                 extern int PROCESSOR_OPTIMIZATIONS; */
 /*                 PROCESSOR_OPTIMIZATIONS = -1; */
-                AC_ERROR("Give an optimization level: 0, 1, 2\n");
+                AC_ERROR("Give an optimization level: 0, 1, 2, 3\n");
                 exit(EXIT_FAILURE);
               }
               else {
                 extern int PROCESSOR_OPTIMIZATIONS;
                 PROCESSOR_OPTIMIZATIONS = strtol(argv[1], 0, 0);
-                if ((PROCESSOR_OPTIMIZATIONS < 0) || (PROCESSOR_OPTIMIZATIONS > 2)) {
-                  AC_ERROR("Give an optimization level: 0, 1, 2\n");
+                if ((PROCESSOR_OPTIMIZATIONS < 0) || (PROCESSOR_OPTIMIZATIONS > 3)) {
+                  AC_ERROR("Give an optimization level: 0, 1, 2, 3\n");
                   exit(EXIT_FAILURE);
                 }
                 ACOptions_p += sprintf( ACOptions_p, "%s ", argv[0]);
@@ -3813,16 +3813,24 @@ void CreateMakefile(){
   fprintf( output, "%s_syscall.H:\n", project_name);
   fprintf( output, "\tcp %s_syscall.H.tmpl %s_syscall.H\n\n", project_name, project_name);
 
+  COMMENT_MAKE("Region blocks compile independently (make -j); accsim rewrites only the blocks that changed");
+  fprintf( output, "$(OBJS): | $(ACFILESHEAD) $(MODULE)_syscall.H\n\n");
+
+  COMMENT_MAKE("Header dependencies of each object, so a block left untouched is still rebuilt when a header it includes changes");
+  fprintf( output, "DEPS := $(OBJS:.o=.d)\n\n");
+
   fprintf( output, ".cpp.o:\n");
-  fprintf( output, "\t$(CC) $(CFLAGS) $(INC_DIR) -c $<\n\n");
+  fprintf( output, "\t$(CC) $(CFLAGS) $(INC_DIR) -MMD -MP -c $<\n\n");
 
   fprintf( output, ".cc.o:\n");
-  fprintf( output, "\t$(CC) $(CFLAGS) $(INC_DIR) -c $<\n\n");
+  fprintf( output, "\t$(CC) $(CFLAGS) $(INC_DIR) -MMD -MP -c $<\n\n");
+
+  fprintf( output, "-include $(DEPS)\n\n");
 
   fprintf( output, "POWERPCSYSCALL=$(shell grep '\\#define %s_SYSCALL_H' %s_syscall.H )\n\n", project_name, project_name);
 
   fprintf( output, "clean:\n");
-  fprintf( output, "\trm -f $(OBJS) *~ $(EXE) core *.o libdummy.a\n");
+  fprintf( output, "\trm -f $(OBJS) $(DEPS) *~ $(EXE) core *.o *.d libdummy.a\n");
   fprintf( output, "ifeq ($(POWERPCSYSCALL), )\n");
   fprintf( output, "\trm -f %s_syscall.H\n", project_name);
   fprintf( output, "endif\n\n");
@@ -35,7 +35,9 @@
 //////////////////////////////////////////////////////////////////////////////
 
 // Standard includes
+#include <cstdio>
 #include <iostream>
+#include <thread>
 #include <unistd.h>
 
 // SystemC includes
@@ -58,24 +60,58 @@ unsigned ac_module::running_mods = 0;
 /// List of all modules.
 std::list<ac_module*> ac_module::mods_list;
 
+/// Parallel execution state.
+std::mutex ac_module::par_mutex;
+std::condition_variable ac_module::par_kernel_cv;
+bool ac_module::par_scheduler = false;
+bool ac_module::par_cores_running = false;
+std::vector<std::function<void()> > ac_module::par_deferred;
+thread_local ac_module* ac_module::par_self = NULL;
+
 /// Standard constructor.
 ac_module::ac_module() : sc_module(sc_gen_unique_name("ac_module")),
+			 par_state(PAR_OFF),
+			 par_leaving(false),
+			 host_thread(false),
+			 adaptive_quantum(false),
+			 last_interactions(0),
 			 mod_id(next_mod_id++),
 			 ac_exit_status(0){
   ac_qk.set_global_quantum( sc_time(100, SC_NS) );
   ac_qk.reset();
   module_period_ns=5;  //200 MHz = 5ns
+  cycle_time = sc_time(module_period_ns, SC_NS);
+  quantum_cycles = 0;
+  compute_cycle_budget();
+  init_quantum_stats();
+  init_idle();
+  run_active = false;
+  stop_requested = false;
+  intr_pending = false;
   this_mod = mods_list.insert(mods_list.end(), this);
   return;
 }
 
 /// Named constructor.
 ac_module::ac_module(sc_module_name nm) : sc_module(nm),
+			 par_state(PAR_OFF),
+			 par_leaving(false),
+			 host_thread(false),
+			 adaptive_quantum(false),
+			 last_interactions(0),
 			 mod_id(next_mod_id++),
 			 ac_exit_status(0){
   ac_qk.set_global_quantum( sc_time(100, SC_NS) );
   ac_qk.reset();
   module_period_ns=5;  //200 MHz = 5ns
+  cycle_time = sc_time(module_period_ns, SC_NS);
+  quantum_cycles = 0;
+  compute_cycle_budget();
+  init_quantum_stats();
+  init_idle();
+  run_active = false;
+  stop_requested = false;
+  intr_pending = false;
   this_mod = mods_list.insert(mods_list.end(), this);
   return;
 }
@@ -83,6 +119,8 @@ ac_module::ac_module(sc_module_name nm) : sc_module(nm),
 /// Destructor.
 ac_module::~ac_module()
 {
+  // the simulation ended without sc_stop() nor the scheduler
+  par_join();
   mods_list.erase(this_mod);
   return;
 }
@@ -106,11 +144,27 @@ void ac_module::PrintAllStats()
 
 /// Public method that registers module as a running module.
 void ac_module::set_running() {
+  stop_requested = false;
   running_mods++;
 }
 
 /// Public method that unregisters module (ie, it's no longer running).
 void ac_module::set_stopped() {
+  // the loop leaves at its next need_sync() check
+  stop_requested = true;
+  cycle_budget = 0;
+  if (on_host_thread()) {
+    kernel_call([this]() { set_stopped(); });
+    return;
+  }
+  if (run_active) {
+    run_exit = AC_RUN_STOPPED;
+    // no simulation to stop
+    if (!run_kernel) {
+      running_mods--;
+      return;
+    }
+  }
   if (--running_mods == 0) {
     dup2(2, 1); //any output to stdout is redirected for stderr (ex. SystemC stop message)
     sc_stop();
@@ -127,10 +181,609 @@ void ac_module::set_instr_batch_size(unsigned int size)
 void ac_module::set_quantum(unsigned int time_quantum_ns) {
   ac_qk.set_global_quantum( sc_time(time_quantum_ns, SC_NS));
   ac_qk.reset();
+  compute_cycle_budget();
 }
 
 /// Public method that sets the processor frequency(MHz to ns) 
 void ac_module::set_proc_freq(unsigned int proc_freq_mhz) {
+  flush_cycles();
   module_period_ns=1000/proc_freq_mhz;
+  cycle_time = sc_time(module_period_ns, SC_NS);
+  compute_cycle_budget();
+}
+
+/// Sets the frequency of every module (DVFS).
+void ac_module::set_all_proc_freq(unsigned int proc_freq_mhz)
+{
+  std::list<ac_module*>::iterator i;
+
+  for (i = mods_list.begin(); i != mods_list.end(); i++)
+    (*i)->set_proc_freq(proc_freq_mhz);
+}
+
+
+/// Instruction loop placeholder.
+void ac_module::behavior()
+{
+  return;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+// Parallel execution
+//
+// Each parallel module runs its instruction loop (behavior()) on its own
+// host thread. The first module to reach run_parallel() becomes the
+// scheduler: from its SC_THREAD it grants a quantum to every core, serves
+// the kernel requests of the cores (TLM transactions, stop) while they
+// run, and once all of them are back it advances SystemC time by the
+// longest local time, letting the rest of the platform catch up. The
+// kernel is blocked while the cores run, so sc_time_stamp() is stable and
+// only the scheduler thread ever enters it.
+//
+// When the scheduler runs out of work, at sc_stop() (end_of_simulation())
+// or at the latest in the destructor, the host threads still waiting are
+// set to PAR_EXIT: their sync() and kernel_call() return at once, the
+// generated loop sees par_exiting() and behavior() returns, so the thread
+// can be joined.
+
+/// Selects parallel execution.
+void ac_module::set_parallel(bool enable)
+{
+  par_state = enable ? PAR_SYNC : PAR_OFF;
+}
+
+/// Starts the host thread; the first module also runs the scheduler.
+void ac_module::run_parallel()
+{
+  par_host = std::thread(&ac_module::par_thread, this);
+  if (par_scheduler)
+    return;
+  par_scheduler = true;
+
+  // lets the other modules start their host threads
+  wait(SC_ZERO_TIME);
+  par_schedule();
+}
+
+/// Host thread body.
+void ac_module::par_thread()
+{
+  par_self = this;
+  host_thread = true;
+  {
+    std::unique_lock<std::mutex> lk(par_mutex);
+    par_wait(lk);
+  }
+  compute_cycle_budget();
+
+  if (!par_exiting())
+    behavior();
+
+  std::unique_lock<std::mutex> lk(par_mutex);
+  par_state = PAR_DONE;
+  par_kernel_cv.notify_one();
+}
+
+/// Hands control to the scheduler and waits until the core may run again.
+/// Returns at once at the end of simulation.
+void ac_module::par_wait(std::unique_lock<std::mutex> &lk)
+{
+  if (par_state != PAR_EXIT) {
+    par_kernel_cv.notify_one();
+    par_cv.wait(lk, [this]() {
+        return par_state == PAR_RUNNING || par_state == PAR_EXIT;
+      });
+  }
+  if (par_state == PAR_EXIT) {
+    par_leaving = true;
+    stop_requested = true;
+    cycle_budget = 0;
+  }
+}
+
+/// Wakes the host thread with PAR_EXIT and joins it.
+void ac_module::par_join()
+{
+  if (!par_host.joinable())
+    return;
+  {
+    std::unique_lock<std::mutex> lk(par_mutex);
+    if (par_state != PAR_DONE) {
+      par_state = PAR_EXIT;
+      par_cv.notify_one();
+    }
+  }
+  par_host.join();
+}
+
+/// End of simulation (sc_stop()).
+void ac_module::end_of_simulation()
+{
+  par_join();
 }
 
+/// Quantum synchronization.
+void ac_module::sync()
+{
+  flush_cycles();
+  if (!host_thread) {
+    if (ac_qk.need_sync()) {
+      quantum_end();
+      ac_qk.sync();
+      drain_interrupts();
+    }
+  }
+  else if (ac_qk.get_local_time() >= par_budget) {
+    std::unique_lock<std::mutex> lk(par_mutex);
+    if (par_state != PAR_EXIT)
+      par_state = PAR_SYNC;
+    par_wait(lk);
+  }
+  compute_cycle_budget();
+}
+
+/// Moves quantum_cycles into the quantum keeper.
+void ac_module::flush_cycles()
+{
+  if (!quantum_cycles)
+    return;
+  ac_qk.inc(cycle_time * (double) quantum_cycles);
+  quantum_cycles = 0;
+}
+
+/// Recomputes cycle_budget from the time left in the quantum.
+void ac_module::compute_cycle_budget()
+{
+  if (stop_requested) {
+    cycle_budget = 0;
+    return;
+  }
+
+  // without a kernel there is nothing to synchronize with
+  if (run_active && !run_kernel) {
+    cycle_budget = ~0ULL;
+    return;
+  }
+
+  sc_time left;
+  if (!host_thread)
+    left = ac_qk.get_remaining();
+  else if (ac_qk.get_local_time() < par_budget)
+    left = par_budget - ac_qk.get_local_time();
+
+  double cycles = left / cycle_time;
+  cycle_budget = quantum_cycles + (unsigned long long) cycles;
+  if (cycles > (unsigned long long) cycles || !cycles)
+    cycle_budget++;
+}
+
+/// Sleep mode.
+void ac_module::sleep(sc_event &e, sleep_state_t state)
+{
+  // the caller of run() delivers the wake up
+  if (run_active && !run_kernel) {
+    sleep_state = state;
+    run_sleep = true;
+    return;
+  }
+
+  flush_cycles();
+  sleep_state = state;
+  sleeps++;
+  if (state == AC_SLEEP_IDLE)
+    idle_loop_sleeps++;
+
+  if (!host_thread) {
+    // sleep from the local time, not from the last sync point
+    ac_qk.sync();
+    sc_time start = sc_time_stamp();
+    if (intr_sources.empty())
+      wait(e);
+    // an interrupt already posted ends the sleep at once
+    else if (!drain_interrupts()) {
+      wait(e | intr_event);
+      drain_interrupts();
+    }
+    account_idle(sc_time_stamp() - start);
+  }
+  else {
+    // idle until the end of the quantum
+    sc_time local = ac_qk.get_local_time();
+    if (local < par_budget) {
+      account_idle(par_budget - local);
+      ac_qk.set(par_budget);
+    }
+    sync();
+  }
+
+  sleep_state = AC_AWAKE;
+  compute_cycle_budget();
+}
+
+/// Runs 'f' inside the SystemC kernel.
+void ac_module::kernel_call(const std::function<void()> &f)
+{
+  ac_module *self = par_self;
+  if (!self) {
+    f();
+    return;
+  }
+  std::unique_lock<std::mutex> lk(par_mutex);
+  // at the end of simulation there is no kernel left to run it
+  if (self->par_state != PAR_EXIT) {
+    self->par_request = f;
+    self->par_state = PAR_REQUEST;
+  }
+  self->par_wait(lk);
+}
+
+/// Runs 'f' when no core is executing.
+void ac_module::defer_to_sync(const std::function<void()> &f)
+{
+  std::unique_lock<std::mutex> lk(par_mutex);
+  if (par_cores_running) {
+    par_deferred.push_back(f);
+    return;
+  }
+  lk.unlock();
+  f();
+}
+
+/// Scheduler loop, runs on the SC_THREAD of the first parallel module.
+void ac_module::par_schedule()
+{
+  std::list<ac_module*>::iterator i;
+  std::unique_lock<std::mutex> lk(par_mutex);
+
+  for (;;) {
+    // deliver what was deferred while the cores ran
+    while (!par_deferred.empty()) {
+      std::vector<std::function<void()> > deferred;
+      deferred.swap(par_deferred);
+      lk.unlock();
+      for (unsigned int d = 0; d < deferred.size(); d++)
+        deferred[d]();
+      lk.lock();
+    }
+
+    // interrupts posted while the cores ran
+    for (i = mods_list.begin(); i != mods_list.end(); i++)
+      if ((*i)->par_state == PAR_SYNC && !(*i)->intr_sources.empty()) {
+        lk.unlock();
+        (*i)->drain_interrupts();
+        lk.lock();
+      }
+
+    // grant the next quantum; all cores share the smallest one, so none
+    // of them is dragged ahead of its own quantum
+    sc_time round = SC_ZERO_TIME;
+    for (i = mods_list.begin(); i != mods_list.end(); i++)
+      if ((*i)->par_state == PAR_SYNC &&
+          (round == SC_ZERO_TIME || (*i)->ac_qk.get_quantum() < round))
+        round = (*i)->ac_qk.get_quantum();
+
+    unsigned int active = 0;
+    for (i = mods_list.begin(); i != mods_list.end(); i++) {
+      ac_module *m = *i;
+      if (m->par_state != PAR_SYNC)
+        continue;
+      m->ac_qk.reset();
+      m->par_budget = round;
+      m->par_state = PAR_RUNNING;
+      m->par_cv.notify_one();
+      active++;
+    }
+    if (!active)
+      break;
+    par_cores_running = true;
+
+    // serve kernel requests until every core is back
+    for (;;) {
+      bool running = false;
+      bool served = false;
+      for (i = mods_list.begin(); i != mods_list.end(); i++) {
+        ac_module *m = *i;
+        if (m->par_state == PAR_REQUEST) {
+          std::function<void()> f;
+          f.swap(m->par_request);
+          lk.unlock();
+          f();
+          lk.lock();
+          m->par_state = PAR_RUNNING;
+          m->par_cv.notify_one();
+          served = true;
+        }
+        if (m->par_state == PAR_RUNNING || m->par_state == PAR_REQUEST)
+          running = true;
+      }
+      if (!running)
+        break;
+      if (!served)
+        par_kernel_cv.wait(lk);
+    }
+    par_cores_running = false;
+
+    // let the rest of the platform catch up
+    sc_time elapsed = SC_ZERO_TIME;
+    bool all_asleep = true;
+    for (i = mods_list.begin(); i != mods_list.end(); i++) {
+      ac_module *m = *i;
+      if (m->par_state != PAR_SYNC)
+        continue;
+      m->quantum_end();
+      if (m->ac_qk.get_local_time() > elapsed)
+        elapsed = m->ac_qk.get_local_time();
+      if (m->sleep_state == AC_AWAKE)
+        all_asleep = false;
+    }
+
+    // every core sleeps: skip to the next pending event instead of
+    // stepping quantum by quantum. With no pending event nothing can wake
+    // them, so the simulation ends, as it does with serial cores.
+    if (all_asleep) {
+      if (!sc_pending_activity())
+        break;
+      sc_time next = sc_time_to_pending_activity();
+      if (next > elapsed) {
+        for (i = mods_list.begin(); i != mods_list.end(); i++)
+          if ((*i)->par_state == PAR_SYNC)
+            (*i)->account_idle(next - elapsed);
+        elapsed = next;
+      }
+    }
+    lk.unlock();
+    sc_core::wait(elapsed);
+    lk.lock();
+  }
+  par_scheduler = false;
+  lk.unlock();
+
+  // nothing will grant the cores another quantum
+  for (i = mods_list.begin(); i != mods_list.end(); i++)
+    (*i)->par_join();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+// Adaptive quantum and quantum statistics
+
+/// log2 histogram bucket: 0 holds 0, bucket b holds [2^(b-1), 2^b).
+static unsigned int quantum_hist_bucket(unsigned long long v, unsigned int size)
+{
+  unsigned int b = 0;
+  while (v && b < size - 1) {
+    v >>= 1;
+    b++;
+  }
+  return b;
+}
+
+void ac_module::init_quantum_stats()
+{
+  for (unsigned int b = 0; b < QUANTUM_HIST_SIZE; b++) {
+    quantum_hist[b] = 0;
+    sync_rate_hist[b] = 0;
+  }
+  syncs = 0;
+  quiet_syncs = 0;
+  window_syncs = 0;
+  sync_window_end = sc_time(1, SC_MS);
+  synced_time = SC_ZERO_TIME;
+}
+
+/// Enables the adaptive quantum.
+void ac_module::set_adaptive_quantum(unsigned int min_ns, unsigned int max_ns)
+{
+  if (!min_ns || min_ns > max_ns) {
+    std::cerr << "ArchC: invalid adaptive quantum [" << min_ns << ", "
+              << max_ns << "] ns, ignored" << std::endl;
+    return;
+  }
+  adaptive_quantum = true;
+  quantum_min = sc_time(min_ns, SC_NS);
+  quantum_max = sc_time(max_ns, SC_NS);
+
+  sc_time q = ac_qk.get_quantum();
+  if (q < quantum_min) q = quantum_min;
+  if (q > quantum_max) q = quantum_max;
+  ac_qk.local_quantum = q;
+}
+
+/// Registers an interaction counter.
+void ac_module::add_interaction_counter(const unsigned long long &counter)
+{
+  interaction_counters.push_back(&counter);
+  last_interactions += counter;
+}
+
+/// Accounts a quantum boundary and adapts the quantum.
+void ac_module::quantum_end()
+{
+  sc_time local = ac_qk.get_local_time();
+
+  unsigned long long n = 0;
+  for (unsigned int c = 0; c < interaction_counters.size(); c++)
+    n += *interaction_counters[c];
+  bool quiet = (n == last_interactions);
+  last_interactions = n;
+
+  syncs++;
+  if (quiet)
+    quiet_syncs++;
+  synced_time += local;
+  quantum_hist[quantum_hist_bucket((unsigned long long) (local.to_seconds() * 1e9),
+                                   QUANTUM_HIST_SIZE)]++;
+
+  // syncs per simulated millisecond
+  window_syncs++;
+  for (sc_time now = sc_time_stamp() + local; now >= sync_window_end;
+       sync_window_end += sc_time(1, SC_MS)) {
+    sync_rate_hist[quantum_hist_bucket(window_syncs, QUANTUM_HIST_SIZE)]++;
+    window_syncs = 0;
+  }
+
+  if (!adaptive_quantum)
+    return;
+
+  sc_time q = ac_qk.local_quantum;
+  if (quiet) {
+    q = q * 2;
+    if (q > quantum_max) q = quantum_max;
+  }
+  else {
+    q = q / 2;
+    if (q < quantum_min) q = quantum_min;
+  }
+  ac_qk.local_quantum = q;
+}
+
+/// Prints a log2 histogram, skipping empty buckets.
+static void print_quantum_hist(const char *title, const unsigned long long *hist,
+                               unsigned int size)
+{
+  unsigned long long total = 0;
+  for (unsigned int b = 0; b < size; b++)
+    total += hist[b];
+  if (!total)
+    return;
+
+  fprintf(stderr, "    %s:", title);
+  for (unsigned int b = 0; b < size; b++) {
+    if (!hist[b])
+      continue;
+    if (b == 0)
+      fprintf(stderr, " [0]: %llu", hist[b]);
+    else
+      fprintf(stderr, " [%llu,%llu): %llu", 1ULL << (b - 1), 1ULL << b, hist[b]);
+  }
+  fprintf(stderr, "\n");
+}
+
+/// Prints the quantum statistics.
+void ac_module::PrintQuantumStat()
+{
+  fprintf(stderr, "    Quantum syncs: %llu (%llu without interactions)\n",
+          syncs, quiet_syncs);
+  if (!syncs)
+    return;
+  fprintf(stderr, "    Average quantum: %.1f ns, current: %.1f ns%s\n",
+          synced_time.to_seconds() * 1e9 / syncs,
+          ac_qk.get_quantum().to_seconds() * 1e9,
+          adaptive_quantum ? " (adaptive)" : "");
+  print_quantum_hist("Effective quantum (ns)", quantum_hist, QUANTUM_HIST_SIZE);
+  print_quantum_hist("Syncs per simulated ms", sync_rate_hist, QUANTUM_HIST_SIZE);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+// Idle skipping
+
+void ac_module::init_idle()
+{
+  sleep_state = AC_AWAKE;
+  idle_loop_len = 1;
+  idle_pc[0] = idle_pc[1] = ~0U;
+  sleeps = 0;
+  idle_loop_sleeps = 0;
+  idle_cycles = 0;
+}
+
+/// Sets the longest idle loop recognized by idle_loop().
+void ac_module::set_idle_loop(unsigned int len)
+{
+  if (len > 2) {
+    std::cerr << "ArchC: idle loops longer than 2 instructions are not "
+              << "recognized, using 2" << std::endl;
+    len = 2;
+  }
+  idle_loop_len = len;
+}
+
+/// Accounts 't' of sleep as idle cycles.
+void ac_module::account_idle(const sc_time &t)
+{
+  idle_cycles += (unsigned long long) (t / cycle_time);
+}
+
+/// Prints the sleep statistics.
+void ac_module::PrintIdleStat()
+{
+  fprintf(stderr, "    Sleeps: %llu (%llu in idle loops), idle cycles: %llu\n",
+          sleeps, idle_loop_sleeps, idle_cycles);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+// Interrupt sources
+
+/// Registers an interrupt source.
+void ac_module::add_intr_source(ac_intr_source &src)
+{
+  src.intr_owner = this;
+  intr_sources.push_back(&src);
+}
+
+/// Delivers the pending interrupts of every source.
+bool ac_module::drain_interrupts()
+{
+  bool delivered = false;
+  intr_pending = false;
+  for (unsigned int s = 0; s < intr_sources.size(); s++)
+    if (intr_sources[s]->drain_interrupts())
+      delivered = true;
+  return delivered;
+}
+
+/// Prints the statistics of every interrupt source.
+void ac_module::PrintIntrStat()
+{
+  for (unsigned int s = 0; s < intr_sources.size(); s++)
+    intr_sources[s]->PrintIntrStat();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+// Batch execution
+
+/// Runs the instruction loop directly (run() and run_until()).
+ac_module::run_exit_t ac_module::run_batch(unsigned long long instrs,
+                                           unsigned long long count,
+                                           unsigned int pc)
+{
+  if (is_parallel()) {
+    std::cerr << "ArchC: run() is not available for parallel modules" << std::endl;
+    return AC_RUN_STOPPED;
+  }
+
+  if (stop_requested)
+    return AC_RUN_STOPPED;
+
+  sc_process_handle self = sc_get_current_process_handle();
+  run_kernel = sc_is_running() && self.valid() &&
+               self.proc_kind() != SC_METHOD_PROC_;
+  run_begin = instrs;
+  run_end = (count > ~0ULL - instrs) ? ~0ULL : instrs + count;
+  run_pc = pc;
+  run_sleep = false;
+  // the loop returns without a reason only when the program stopped
+  run_exit = AC_RUN_STOPPED;
+
+  run_active = true;
+  bool delivered = drain_interrupts();
+  // a core left waiting for an interrupt by the last run() resumes only
+  // once a source delivers one; an idle loop resumes to see the new time
+  if (sleep_state == AC_SLEEP_WFI && !run_kernel && !intr_sources.empty() &&
+      !delivered) {
+    run_active = false;
+    return AC_RUN_SLEEP;
+  }
+  sleep_state = AC_AWAKE;
+  compute_cycle_budget();
+  behavior();
+  flush_cycles();
+  run_active = false;
+  compute_cycle_budget();
+
+  return run_exit;
+}
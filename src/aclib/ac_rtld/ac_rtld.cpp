@@ -35,10 +35,13 @@
  */
 
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "ac_utils.H"
 
 
@@ -49,14 +52,30 @@
 namespace ac_dynlink {
 
   ac_rtld::ac_rtld() {
+    rtld_config = NULL;
     root = NULL;
     initiated = false;
     glibc = false;
     word_size = 0;
+    lazy_binding = false;
+    lazy_begin = 0;
+    prelink_key = 0;
   }
   
   ac_rtld::~ac_rtld() {
     delete root;
+    delete rtld_config;
+  }
+
+  /* 64-bit FNV-1a, for the prelink cache key */
+  static unsigned long long prelink_hash(unsigned long long h, const void *data, size_t n) {
+    const unsigned char *p = (const unsigned char *) data;
+
+    while (n--) {
+      h ^= *p++;
+      h *= 0x100000001b3ULL;
+    }
+    return h;
   }
   
   /* Iterates and loads all shared libraries requested by the executable program
@@ -87,10 +106,12 @@ namespace ac_dynlink {
     /* Iterates through all loaded objects in order
        to find any undefined symbol and, if found,
        resolve its location using the exported symbols
-       from other loaded objects.*/
+       from other loaded objects. With lazy binding,
+       symbols only called through the PLT are left
+       to bind_lazy().*/
     p = root;
     while (p != NULL) {
-      p->resolve_symbols();
+      p->resolve_symbols(lazy_binding);
       p = p->get_next();
     }
     
@@ -99,7 +120,8 @@ namespace ac_dynlink {
        relocations.*/
     p = root;
     while (p != NULL) {
-      p->apply_relocations(mem, word_size);
+      p->apply_relocations(mem, word_size, lazy_binding ? &lazy_slots : NULL,
+                           lazy_begin);
       p = p->get_next();
     }
 
@@ -157,6 +179,17 @@ namespace ac_dynlink {
       mem_map.add_region(start_addr, end_addr - start_addr);
       mem_map.set_brk_addr(brkaddr);
       detect_static_glibc(fd, match_endian);
+
+      /* The prelink cache is keyed by the contents of the program */
+      struct stat st;
+      if (getenv(ENV_AC_PRELINK_CACHE) != NULL && fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (file != MAP_FAILED) {
+          prelink_key = prelink_hash(0xcbf29ce484222325ULL, file, st.st_size);
+          prelink_key = prelink_hash(prelink_key, &memsize, sizeof(memsize));
+          munmap(file, st.st_size);
+        }
+      }
     }
   }
     
@@ -166,18 +199,49 @@ namespace ac_dynlink {
 			 unsigned char word_size, bool match_endian, Elf32_Word mem_size,
 			 unsigned int& ac_heap_ptr) {
     unsigned *initvec, initvecn;
+    Elf32_Addr libs_addr;
     this->word_size = word_size;
     this->glibc = true;
+
+    if (prelink_key != 0) {
+      const char *libpath = getenv(ENV_AC_LIBRARY_PATH);
+      prelink_key = prelink_hash(prelink_key, &word_size, sizeof(word_size));
+      prelink_key = prelink_hash(prelink_key, &match_endian, sizeof(match_endian));
+      if (libpath != NULL)
+        prelink_key = prelink_hash(prelink_key, libpath, strlen(libpath));
+      /* Lazy slots refer to the link nodes, which a prelinked image does
+         not have: images are bound at once. */
+      lazy_binding = false;
+      if (load_prelinked(mem, mem_size, start_addr, ac_heap_ptr))
+        return;
+    }
     
-    if (rtld_config.is_config_loaded())
-      root = new link_node(NULL, &rtld_config);
+    rtld_config = new ac_rtld_config();
+    if (rtld_config->is_config_loaded())
+      root = new link_node(NULL, rtld_config);
     else
       root = new link_node(NULL, NULL);
     root->set_root(root);
     root->set_program_interpreter(pinterp);
     root->link_node_setup(dynaddr, mem, 0, ET_EXEC, NULL, NULL, match_endian);
     
+    libs_addr = mem_map.suggest_free_region(0);
     load_libraries(mem, mem_size);
+
+    /* Reserve one trap address for each PLT slot. Nothing is stored
+       there: the simulator catches jumps to them, see bind_lazy(). */
+    if (lazy_binding) {
+      unsigned n = 0;
+      for (link_node *p = root; p != NULL; p = p->get_next())
+        n += p->count_jump_slots();
+      if (n == 0)
+        lazy_binding = false;
+      else {
+        lazy_begin = mem_map.suggest_free_region(n * AC_RTLD_LAZY_STRIDE);
+        mem_map.add_region(lazy_begin, n * AC_RTLD_LAZY_STRIDE);
+        lazy_slots.reserve(n);
+      }
+    }
     
     ac_heap_ptr = mem_map.suggest_free_region(0);
 
@@ -195,6 +259,239 @@ namespace ac_dynlink {
         initvec[i] = initvec[i+1];
       initvec[i] = tmp;
     }
+
+    if (prelink_key != 0)
+      save_prelinked(mem, start_addr, libs_addr, ac_heap_ptr);
+  }
+
+  /* Prelink cache file (host byte order, 32-bit fields unless noted):
+       "ACPRLNK1", key (64-bit), start address, heap pointer,
+       first library address,
+       number of libraries, for each: name length, name, size and
+         modification time (64-bit each) of the file,
+       number of init functions, their addresses,
+       number of fini functions, their addresses,
+       number of extents, for each: address, size, contents.
+     The extents are the non-zero pages of the guest memory below the
+     heap pointer after linking; the rest of it is zero. */
+#define AC_PRELINK_MAGIC "ACPRLNK1"
+#define AC_PRELINK_PAGE 4096
+
+  std::string ac_rtld::prelink_file_name() {
+    char name[32];
+
+    snprintf(name, sizeof(name), "/%016llx.prelink", prelink_key);
+    return std::string(getenv(ENV_AC_PRELINK_CACHE)) + name;
+  }
+
+  /* Reads n bytes at p, false past end */
+  static bool prelink_read(const unsigned char *&p, const unsigned char *end, void *dst, size_t n) {
+    if ((size_t) (end - p) < n)
+      return false;
+    memcpy(dst, p, n);
+    p += n;
+    return true;
+  }
+
+  /* Copies the cached image of this program into the guest memory and sets
+     up the state the loader would. False if there is no valid image, in
+     which case nothing was changed. */
+  bool ac_rtld::load_prelinked(unsigned char *mem, Elf32_Word mem_size, Elf32_Addr& start_addr,
+                               unsigned int& ac_heap_ptr) {
+    std::string file = prelink_file_name();
+    struct stat st;
+    const unsigned char *image, *p, *end, *vectors, *extents;
+    unsigned long long key;
+    Elf32_Addr cached_start, cached_heap, cached_libs, addr, size;
+    unsigned n, i, initn, finin;
+    char magic[8];
+    bool valid;
+    int fd;
+
+    fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      close(fd);
+      return false;
+    }
+    image = (const unsigned char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED)
+      return false;
+    p = image;
+    end = image + st.st_size;
+
+    /* Check everything before touching the guest memory */
+    valid = prelink_read(p, end, magic, sizeof(magic)) &&
+      memcmp(magic, AC_PRELINK_MAGIC, sizeof(magic)) == 0 &&
+      prelink_read(p, end, &key, sizeof(key)) && key == prelink_key &&
+      prelink_read(p, end, &cached_start, sizeof(cached_start)) &&
+      prelink_read(p, end, &cached_heap, sizeof(cached_heap)) &&
+      prelink_read(p, end, &cached_libs, sizeof(cached_libs)) &&
+      cached_libs <= cached_heap && cached_heap <= mem_size &&
+      prelink_read(p, end, &n, sizeof(n));
+    for (i = 0; valid && i < n; i++) {
+      unsigned len;
+      unsigned long long lib_size, lib_mtime;
+      struct stat lib_st;
+
+      valid = prelink_read(p, end, &len, sizeof(len)) && (size_t) (end - p) >= len;
+      if (valid) {
+        std::string lib((const char *) p, len);
+        p += len;
+        valid = prelink_read(p, end, &lib_size, sizeof(lib_size)) &&
+          prelink_read(p, end, &lib_mtime, sizeof(lib_mtime)) &&
+          stat(lib.c_str(), &lib_st) == 0 &&
+          (unsigned long long) lib_st.st_size == lib_size &&
+          (unsigned long long) lib_st.st_mtime == lib_mtime;
+      }
+    }
+    vectors = p;
+    valid = valid && prelink_read(p, end, &initn, sizeof(initn)) &&
+      (size_t) (end - p) / sizeof(unsigned) >= initn;
+    if (valid)
+      p += initn * sizeof(unsigned);
+    valid = valid && prelink_read(p, end, &finin, sizeof(finin)) &&
+      (size_t) (end - p) / sizeof(unsigned) >= finin;
+    if (valid)
+      p += finin * sizeof(unsigned);
+    valid = valid && prelink_read(p, end, &n, sizeof(n));
+    extents = p;
+    for (i = 0, addr = 0; valid && i < n; i++) {
+      Elf32_Addr ext_addr;
+      valid = prelink_read(p, end, &ext_addr, sizeof(ext_addr)) &&
+        prelink_read(p, end, &size, sizeof(size)) &&
+        ext_addr >= addr && ext_addr <= cached_heap && size <= cached_heap - ext_addr &&
+        (size_t) (end - p) >= size;
+      if (valid) {
+        p += size;
+        addr = ext_addr + size;
+      }
+    }
+    if (!valid) {
+      munmap((void *) image, st.st_size);
+      return false;
+    }
+
+    AC_SAY("Using prelinked image " << file);
+
+    /* Guest memory */
+    p = extents;
+    for (i = 0, addr = 0; i < n; i++) {
+      Elf32_Addr ext_addr;
+      prelink_read(p, end, &ext_addr, sizeof(ext_addr));
+      prelink_read(p, end, &size, sizeof(size));
+      memset(mem + addr, 0, ext_addr - addr);
+      memcpy(mem + ext_addr, p, size);
+      p += size;
+      addr = ext_addr + size;
+    }
+    memset(mem + addr, 0, cached_heap - addr);
+
+    /* Loader state: init/fini functions and the memory map */
+    root = new link_node(NULL, NULL);
+    root->set_root(root);
+    p = vectors;
+    prelink_read(p, end, &initn, sizeof(initn));
+    for (i = 0; i < initn; i++) {
+      prelink_read(p, end, &addr, sizeof(addr));
+      root->add_to_start_vector(addr);
+    }
+    prelink_read(p, end, &finin, sizeof(finin));
+    for (i = 0; i < finin; i++) {
+      prelink_read(p, end, &addr, sizeof(addr));
+      root->add_to_fini_vector(addr);
+    }
+    munmap((void *) image, st.st_size);
+
+    if (cached_heap > cached_libs)
+      mem_map.add_region(cached_libs, cached_heap - cached_libs);
+    mem_map.set_brk_addr(cached_heap);
+    start_addr = cached_start;
+    ac_heap_ptr = cached_heap;
+    return true;
+  }
+
+  /* Stores the linked image for the next runs of this program. The file is
+     written under a temporary name and renamed, so concurrent runs never
+     see a partial image. */
+  void ac_rtld::save_prelinked(unsigned char *mem, Elf32_Addr start_addr, Elf32_Addr libs_addr,
+                               unsigned int ac_heap_ptr) {
+    std::string file = prelink_file_name();
+    char suffix[32];
+    Elf32_Addr heap = ac_heap_ptr, addr, ext_end, size;
+    std::vector<Elf32_Addr> extents;
+    unsigned n, i;
+    link_node *p;
+    bool ok = true;
+    FILE *f;
+
+    snprintf(suffix, sizeof(suffix), ".%d", (int) getpid());
+    std::string tmp = file + suffix;
+    f = fopen(tmp.c_str(), "wb");
+    if (f == NULL) {
+      AC_WARN("Run-time dynamic linker: could not create prelinked image " << file);
+      return;
+    }
+
+    ok = fwrite(AC_PRELINK_MAGIC, 8, 1, f) == 1 &&
+      fwrite(&prelink_key, sizeof(prelink_key), 1, f) == 1 &&
+      fwrite(&start_addr, sizeof(start_addr), 1, f) == 1 &&
+      fwrite(&heap, sizeof(heap), 1, f) == 1 &&
+      fwrite(&libs_addr, sizeof(libs_addr), 1, f) == 1;
+
+    for (n = 0, p = root->get_next(); p != NULL; p = p->get_next())
+      n++;
+    ok = ok && fwrite(&n, sizeof(n), 1, f) == 1;
+    for (p = root->get_next(); ok && p != NULL; p = p->get_next()) {
+      struct stat lib_st;
+      unsigned len = p->get_file_name().size();
+      unsigned long long lib_size, lib_mtime;
+
+      ok = stat(p->get_file_name().c_str(), &lib_st) == 0;
+      lib_size = lib_st.st_size;
+      lib_mtime = lib_st.st_mtime;
+      ok = ok && fwrite(&len, sizeof(len), 1, f) == 1 &&
+        fwrite(p->get_file_name().data(), 1, len, f) == len &&
+        fwrite(&lib_size, sizeof(lib_size), 1, f) == 1 &&
+        fwrite(&lib_mtime, sizeof(lib_mtime), 1, f) == 1;
+    }
+
+    n = get_init_arraysz();
+    ok = ok && fwrite(&n, sizeof(n), 1, f) == 1 &&
+      fwrite(get_init_array(), sizeof(unsigned), n, f) == n;
+    n = get_fini_arraysz();
+    ok = ok && fwrite(&n, sizeof(n), 1, f) == 1 &&
+      fwrite(get_fini_array(), sizeof(unsigned), n, f) == n;
+
+    /* Runs of non-zero pages */
+    for (addr = 0; addr < heap; addr = ext_end) {
+      ext_end = addr + AC_PRELINK_PAGE < heap ? addr + AC_PRELINK_PAGE : heap;
+      for (i = addr; i < ext_end && mem[i] == 0; i++)
+        ;
+      if (i == ext_end)
+        continue;
+      if (!extents.empty() && extents.back() == addr)
+        extents.back() = ext_end;
+      else {
+        extents.push_back(addr);
+        extents.push_back(ext_end);
+      }
+    }
+    n = extents.size() / 2;
+    ok = ok && fwrite(&n, sizeof(n), 1, f) == 1;
+    for (i = 0; ok && i < extents.size(); i += 2) {
+      size = extents[i+1] - extents[i];
+      ok = fwrite(&extents[i], sizeof(Elf32_Addr), 1, f) == 1 &&
+        fwrite(&size, sizeof(size), 1, f) == 1 &&
+        fwrite(mem + extents[i], 1, size, f) == size;
+    }
+
+    if (fclose(f) != 0 || !ok || rename(tmp.c_str(), file.c_str()) != 0) {
+      unlink(tmp.c_str());
+      AC_WARN("Run-time dynamic linker: could not write prelinked image " << file);
+    }
   }
   
 
@@ -202,6 +499,34 @@ namespace ac_dynlink {
   bool ac_rtld::is_glibc() {
     return this->glibc;
   }
+
+  /* Called by simulators able to run bind_lazy() on jumps to the trap
+     addresses, before loading the program. AC_BIND_NOW in the environment
+     keeps all bindings at load time. */
+  void ac_rtld::set_lazy_binding(bool value) {
+    lazy_binding = value && getenv("AC_BIND_NOW") == NULL;
+  }
+
+  Elf32_Addr ac_rtld::get_lazy_begin() {
+    return lazy_begin;
+  }
+
+  Elf32_Addr ac_rtld::get_lazy_end() {
+    return lazy_begin + lazy_slots.size() * AC_RTLD_LAZY_STRIDE;
+  }
+
+  /* First call through a lazy PLT slot: the program jumped to trap.
+     Returns where the call goes, or 0 if trap is not a lazy binding
+     trap, and the address of the slot to patch with it in slot. */
+  Elf32_Addr ac_rtld::bind_lazy(Elf32_Addr trap, Elf32_Addr &slot) {
+    Elf32_Addr n;
+
+    if (trap < get_lazy_begin() || trap >= get_lazy_end() ||
+        (trap - lazy_begin) % AC_RTLD_LAZY_STRIDE != 0)
+      return 0;
+    n = (trap - lazy_begin) / AC_RTLD_LAZY_STRIDE;
+    return lazy_slots[n].node->bind_lazy_slot(lazy_slots[n].reloc, slot);
+  }
   
   
   bool ac_rtld::detect_static_glibc(int fd, bool match_endian) {
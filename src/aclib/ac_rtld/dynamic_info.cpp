@@ -49,14 +49,16 @@ namespace ac_dynlink {
   
   /* Given a library name, find its location and open it. Return a descriptor 
      to the open file.*/
-  int dynamic_info::find_library (const char *soname) 
+  int dynamic_info::find_library (const char *soname, std::string& file_name) 
   {
     int fd;
     unsigned int i, j, k;
     char *envpath, *apath;
     fd = open(soname,0);
-    if (fd > 0)
+    if (fd > 0) {
+      file_name = soname;
       return fd;
+    }
     envpath = getenv(ENV_AC_LIBRARY_PATH);
     if (envpath == NULL)
       return -1;
@@ -77,6 +79,7 @@ namespace ac_dynlink {
 	    fd = open(apath, 0);
 	    if (fd > 0)
 	      {
+		file_name = apath;
 		delete [] apath;
 		return fd;
 	      }
@@ -204,6 +207,7 @@ namespace ac_dynlink {
           Elf32_Addr load_addr = mem_map->suggest_free_region(0), dyn_addr = 0;
           Elf32_Word dyn_size = 0;
           link_node *p;
+          std::string file_name;
           soname = static_cast<unsigned char*>(mem + get_value(DT_STRTAB) + entry->d_un.d_val);
           
           /* Verifies if library is already loaded */
@@ -216,15 +220,18 @@ namespace ac_dynlink {
           if (p)
             continue; /* library is already loaded */
           
-          mem_map->add_region(load_addr, load_library(load_addr, mem, soname, dyn_addr, dyn_size, mem_size));
+          mem_map->add_region(load_addr, load_library(load_addr, mem, soname, dyn_addr, dyn_size, mem_size,
+                                                      file_name));
           
           if (dyn_addr == 0 || dyn_size == 0) {
             AC_ERROR("Run-time dynamic linker: Could not find DYNAMIC segment of library \"" << soname << "\".\n");
             exit(EXIT_FAILURE);
           }
           
-          if (l_node->new_node()->link_node_setup(dyn_addr, mem, load_addr, ET_DYN,
-						  soname, verneed, match_endian) == false)
+          p = l_node->new_node();
+          p->set_file_name(file_name);
+          if (p->link_node_setup(dyn_addr, mem, load_addr, ET_DYN,
+                                 soname, verneed, match_endian) == false)
 	    {
 	      /* Library was rejected because it is old */
 	      AC_ERROR("run-time dynamic linker: Loaded library \"" << soname << "\"is \
@@ -239,7 +246,8 @@ old and can't be used (version mismatch).\n");
        loaded at address "load_addr". If a DYNAMIC segment is present, "dyn_addr" and "dyn_size"
        by reference parameters are filled with its address and size.*/
   Elf32_Word dynamic_info::load_library (Elf32_Addr load_addr, unsigned char *mem, unsigned char *soname,
-					 Elf32_Addr& dyn_addr, Elf32_Word& dyn_size, Elf32_Word mem_size) {
+					 Elf32_Addr& dyn_addr, Elf32_Word& dyn_size, Elf32_Word mem_size,
+                                         std::string& file_name) {
     Elf32_Ehdr    ehdr;
     Elf32_Phdr    phdr;
     int           fd;
@@ -247,7 +255,7 @@ old and can't be used (version mismatch).\n");
     Elf32_Word    total_size = 0;
     
     //Open application
-    if (!soname || ((fd = find_library((char *)soname)) == -1)) {
+    if (!soname || ((fd = find_library((char *)soname, file_name)) == -1)) {
       AC_ERROR("Run-time dynamic linker: Could not find shared library \"" << soname << "\"." << std::endl << "Please properly configure the environment variable AC_LIBRARY_PATH.");
       exit(EXIT_FAILURE);
     }
@@ -50,6 +50,11 @@ namespace ac_dynlink {
 
   /* Private methods */
 
+  /* Hash table words are in the object's byte order */
+  Elf32_Word dynamic_symbol_table::read_word(const Elf32_Word *word) {
+    return convert_endian(4, *word, match_endian);
+  }
+
   /* After a symbol is fetched from the hash table, verifies
      if it is a match. */
   Elf32_Sym *dynamic_symbol_table::check_symbol(Elf_Symndx symndx, unsigned char *name, 
@@ -140,6 +145,9 @@ namespace ac_dynlink {
   /* Public methods */
 
   dynamic_symbol_table::dynamic_symbol_table() {
+    nbuckets = 0;
+    nchain = 0;
+    gnu_nbuckets = 0;
     versym = NULL;
     verneed = NULL;
     verdefs = NULL;
@@ -166,19 +174,68 @@ namespace ac_dynlink {
     return hash;
   }
 
+  /* GNU hashing function (DT_GNU_HASH), the one of dl_new_hash() */
+  unsigned int dynamic_symbol_table::gnu_hash (const unsigned char *name) {
+    Elf32_Word hash = 5381;
+
+    while (*name != '\0')
+      hash = hash * 33 + *name++;
+    return hash;
+  }
+
   void dynamic_symbol_table::setup_hash(unsigned char *mem, Elf32_Addr hash_addr,
+					Elf32_Addr gnu_hash_addr,
 					Elf32_Addr symtab_addr, Elf32_Addr strtab_addr, Elf32_Addr verdef_addr,
 					Elf32_Addr verneed_addr, Elf32_Addr versym_addr, bool match_endian) {
-    Elf_Symndx *hash = reinterpret_cast<Elf_Symndx *> (mem + hash_addr);
-    
     this->match_endian = match_endian;
 
-    nbuckets =  *hash++;
-    nchain = *hash++;
-    buckets = static_cast<Elf_Symndx *>(hash);
-    hash += nbuckets;
-    chain = static_cast<Elf_Symndx *>(hash);
-    
+    if (hash_addr != 0) {
+      Elf_Symndx *hash = reinterpret_cast<Elf_Symndx *> (mem + hash_addr);
+
+      nbuckets = read_word(hash++);
+      nchain = read_word(hash++);
+      buckets = static_cast<Elf_Symndx *>(hash);
+      hash += nbuckets;
+      chain = static_cast<Elf_Symndx *>(hash);
+    }
+
+    if (gnu_hash_addr != 0) {
+      Elf32_Word *hash = reinterpret_cast<Elf32_Word *> (mem + gnu_hash_addr);
+
+      gnu_nbuckets = read_word(hash++);
+      gnu_symoffset = read_word(hash++);
+      gnu_bloom_size = read_word(hash++);
+      gnu_bloom_shift = read_word(hash++);
+      gnu_bloom = hash;
+      hash += gnu_bloom_size;
+      gnu_buckets = static_cast<Elf_Symndx *>(hash);
+      hash += gnu_nbuckets;
+      gnu_chain = hash;
+
+      /* Objects without DT_HASH: the symbol count is one past the end of
+         the last chain */
+      if (hash_addr == 0) {
+        Elf_Symndx last = 0;
+        for (unsigned int i = 0; i < gnu_nbuckets; i++)
+          if (read_word(&gnu_buckets[i]) > last)
+            last = read_word(&gnu_buckets[i]);
+        if (last < gnu_symoffset)
+          nchain = gnu_symoffset;
+        else {
+          while (!(read_word(&gnu_chain[last - gnu_symoffset]) & 1))
+            last++;
+          nchain = last + 1;
+        }
+        /* Symbols left out of the hash table (undefined ones) may lie past
+           symoffset too; .dynstr follows .dynsym, so use it as a bound. */
+        if (strtab_addr > symtab_addr &&
+            (strtab_addr - symtab_addr) / sizeof(Elf32_Sym) > nchain)
+          nchain = (strtab_addr - symtab_addr) / sizeof(Elf32_Sym);
+      }
+      if (gnu_nbuckets == 0 || gnu_bloom_size == 0)
+        gnu_nbuckets = 0;
+    }
+
     symtab = reinterpret_cast<Elf32_Sym *> (mem + symtab_addr);
     strtab = static_cast<unsigned char *> (mem + strtab_addr);
     
@@ -190,7 +247,12 @@ namespace ac_dynlink {
       versym = reinterpret_cast<Elf_Verndx *> (mem + versym_addr);
   }
   
-  Elf32_Sym *dynamic_symbol_table::lookup_symbol(unsigned int hash, unsigned char *name,
+  /* hash and ghash are the SysV and GNU hashes of name. With a GNU
+     table, the Bloom filter rejects most names not defined here without
+     touching the buckets, and only chain entries with the same hash are
+     compared. */
+  Elf32_Sym *dynamic_symbol_table::lookup_symbol(unsigned int hash, unsigned int ghash,
+						 unsigned char *name,
 						 char *vername, Elf32_Word verhash) {
     Elf_Symndx symndx;
     Elf32_Sym *symbol = NULL;
@@ -199,12 +261,35 @@ namespace ac_dynlink {
     last_match = NULL;
     is_unique_match = true;
     
-    for ( symndx = buckets[hash % nbuckets];
-	  symndx != STN_UNDEF;
-	  symndx = chain[symndx] ) {
-      symbol = check_symbol(symndx, name, vername, verhash);
-      if (symbol != NULL)
-	return symbol;
+    if (gnu_nbuckets != 0) {
+      Elf32_Word bloom = read_word(&gnu_bloom[(ghash / 32) % gnu_bloom_size]);
+      Elf32_Word mask = (1U << (ghash % 32)) |
+        (1U << ((ghash >> gnu_bloom_shift) % 32));
+      if ((bloom & mask) != mask)
+        return NULL;
+
+      symndx = read_word(&gnu_buckets[ghash % gnu_nbuckets]);
+      if (symndx < gnu_symoffset)
+        return NULL;
+      for (;; symndx++) {
+        Elf32_Word chash = read_word(&gnu_chain[symndx - gnu_symoffset]);
+        if ((chash | 1) == (ghash | 1)) {
+          symbol = check_symbol(symndx, name, vername, verhash);
+          if (symbol != NULL)
+            return symbol;
+        }
+        if (chash & 1) /* End of chain */
+          break;
+      }
+    }
+    else if (nbuckets != 0) {
+      for ( symndx = read_word(&buckets[hash % nbuckets]);
+	    symndx != STN_UNDEF;
+	    symndx = read_word(&chain[symndx]) ) {
+        symbol = check_symbol(symndx, name, vername, verhash);
+        if (symbol != NULL)
+	  return symbol;
+      }
     }
     
     if (last_match != NULL &&
@@ -209,16 +209,27 @@ namespace ac_dynlink {
     return soname; 
   }
 
-  Elf32_Sym *link_node::lookup_local_symbol(unsigned int hash, unsigned char *name,
+  const std::string& link_node::get_file_name()
+  {
+    return file_name;
+  }
+
+  void link_node::set_file_name(const std::string& name)
+  {
+    file_name = name;
+  }
+
+  Elf32_Sym *link_node::lookup_local_symbol(unsigned int hash, unsigned int ghash,
+					    unsigned char *name,
 					    char *vername, Elf32_Word verhash) 
   { 
-    return dyn_table.lookup_symbol(hash, name, vername, verhash);
+    return dyn_table.lookup_symbol(hash, ghash, name, vername, verhash);
   }
 
   bool link_node::link_node_setup(Elf32_Addr dynaddr, unsigned char *mem,
 				  Elf32_Addr l_addr, unsigned int t, unsigned char *name,
 				  version_needed *verneed, bool match_endian) {
-    Elf32_Addr hashaddr = 0, symaddr= 0, straddr = 0, reladdr = 0,
+    Elf32_Addr hashaddr = 0, gnu_hashaddr = 0, symaddr= 0, straddr = 0, reladdr = 0,
       verneed_addr = 0, verdef_addr = 0, versym_addr = 0, init_addr = 0,
       init_addr_array = 0, init_addr_arraysz = 0, fini_addr = 0,
       fini_addr_array = 0, fini_addr_arraysz = 0;
@@ -236,6 +247,7 @@ namespace ac_dynlink {
     dyn_info.load_dynamic_info(dynaddr, mem, match_endian);
     
     hashaddr = dyn_info.get_value(DT_HASH);
+    gnu_hashaddr = dyn_info.get_value(DT_GNU_HASH);
     symaddr = dyn_info.get_value(DT_SYMTAB);
     straddr = dyn_info.get_value(DT_STRTAB);
     verneed_addr = dyn_info.get_value(DT_VERNEED);
@@ -255,6 +267,8 @@ namespace ac_dynlink {
     
     if (hashaddr) 
       hashaddr += l_addr;
+    if (gnu_hashaddr) 
+      gnu_hashaddr += l_addr;
     if (symaddr) 
       symaddr += l_addr;
     if (straddr) 
@@ -301,7 +315,7 @@ namespace ac_dynlink {
        extracting needed libraries names. */
     dyn_info.set_value(DT_STRTAB, straddr);
     
-    dyn_table.setup_hash(mem, hashaddr, symaddr, straddr, verdef_addr,
+    dyn_table.setup_hash(mem, hashaddr, gnu_hashaddr, symaddr, straddr, verdef_addr,
 			 verneed_addr, versym_addr, match_endian);
     
     pltrel = dyn_info.get_value(DT_PLTREL);
@@ -455,21 +469,36 @@ namespace ac_dynlink {
   /* Finds a defined version of the symbol looking through 
      all loaded libraries. If exclude_root is true, skips
      root file symbols when looking for the symbol.
+     The same symbol is usually requested by many relocations and
+     libraries, so results are cached in the root node.
    */
   Elf32_Sym * link_node::find_symbol(unsigned char *name, char *vername, Elf32_Word verhash, 
                                      bool exclude_root)
   {
     link_node *p = root;
-    unsigned int symhash = dyn_table.elf_hash(name);
+    unsigned int symhash, gnuhash;
     Elf32_Sym *the_symbol = NULL, *weak_sym = NULL;
     symbol_wrapper *symbol;
+    std::string key((char *)name);
+
+    key += '\0';
+    if (vername != NULL)
+      key += vername;
+    key += '\0';
+    key += exclude_root ? 'r' : 'a';
+    std::map<std::string, Elf32_Sym *>::iterator cached = root->symbol_cache.find(key);
+    if (cached != root->symbol_cache.end())
+      return cached->second;
+
+    symhash = dyn_table.elf_hash(name);
+    gnuhash = dyn_table.gnu_hash(name);
 
     if (exclude_root == true)
       p = p->get_next();
     
     while (p != NULL)
       {
-	the_symbol = p->lookup_local_symbol(symhash, name, vername, verhash);
+	the_symbol = p->lookup_local_symbol(symhash, gnuhash, name, vername, verhash);
         if (the_symbol != NULL) {
           symbol = new symbol_wrapper(the_symbol, match_endian);
           if (ELF32_ST_BIND(symbol->read_info()) == STB_WEAK) {
@@ -497,104 +526,117 @@ namespace ac_dynlink {
 
     
     if (the_symbol == NULL && weak_sym != NULL)
-      return weak_sym;
+      the_symbol = weak_sym;
+    root->symbol_cache[key] = the_symbol;
     return the_symbol;
   }
   
-  /* Walks through object's relocations, finds out if the symbol
-     is undefined. If it is, Look up for its definition in other
-     nodes */
-  void link_node::resolve_symbols() 
+#define FETCH_RELOC_TYPE(a,b)                                              \
+        if (rtld_config != NULL) {                                         \
+          if (rtld_config->translate(ELF32_R_TYPE(a), &b)==-1)             \
+            {                                                              \
+              b = ELF32_R_TYPE(a);                                         \
+            }                                                              \
+        } else {                                                           \
+          b = ELF32_R_TYPE(a);                                             \
+        }
+
+  /* Finds out if the symbol of relocation i is undefined. If it is,
+     looks up for its definition in other nodes */
+  void link_node::resolve_symbol(unsigned int i)
   {
-    unsigned int i;
     Elf32_Word info, verhash;
     Elf_Symndx symndx;
     Elf32_Sym *elf_symbol, *def_elf_symbol;
     symbol_wrapper *symbol, *def_symbol;
     char *vername;
     unsigned char symbol_info = 0, weak = 0;
-    
+
+    info = dyn_relocs.read_info(i);
+    symndx = ELF32_R_SYM(info);
+    elf_symbol = dyn_table.get_symbol(symndx);
+    symbol = new symbol_wrapper(elf_symbol, match_endian);
+    symbol_info = symbol->read_info();
+
+    if (ELF32_ST_TYPE(symbol_info) > STT_FUNC &&
+        ELF32_ST_TYPE(symbol_info) != STT_COMMON) {
+      delete symbol;
+      return; /* Not a symbol type we need to resolve */
+    }
+
+    if (ELF32_ST_BIND(symbol_info) == STB_LOCAL ||
+        ELF32_ST_BIND(symbol_info) > STB_WEAK) {
+      delete symbol;
+      return; /* Not global or weak */
+    }
+
+    if (ELF32_ST_BIND(symbol_info) == STB_WEAK) {
+      weak = 1;
+    }
+
+    if (symbol->read_section_ndx() != SHN_UNDEF) {
+      delete symbol;
+      return;  /* Symbol is not undefined, no need to resolve */
+    }
+
+    vername = NULL;
+    verhash = 0;
+    /* Are we requesting a special version? */
+    if (dyn_table.get_verneed() != NULL)
+      {
+        Elf32_Half verndx = dyn_table.get_verndx(symndx);
+        vername = dyn_table.get_verneed()->lookup_version(verndx & 0x7fff);
+        verhash = dyn_table.get_verneed()->get_cur_hash();
+      }
+
+    def_elf_symbol = NULL;
+    def_elf_symbol = find_symbol(dyn_table.get_name(symbol->read_name_ndx()), vername, verhash, false);
+
+    if (def_elf_symbol == NULL)  /* Symbol not found. */
+      {
+        if (weak) {
+          delete symbol;
+          return; /* Definition for this symbol is not a problem */
+        }
+        AC_ERROR("Run-time dynamic linker: Symbol \"" <<
+                 dyn_table.get_name(symbol->read_name_ndx()) << "\" unknown.");
+        exit(EXIT_FAILURE);
+      }
+
+    /* Symbol found */
+    def_symbol = new symbol_wrapper(def_elf_symbol, match_endian);
+    symbol->write_value(def_symbol->read_value());
+    symbol->write_size(def_symbol->read_size());
+    symbol->write_section_ndx(def_symbol->read_section_ndx());
+    symbol->write_info(def_symbol->read_info());
+
+    /* Done */
+    delete def_symbol;
+    delete symbol;
+  } /* resolve_symbol() */
+
+  /* Walks through object's relocations and resolves their symbols.
+     If lazy is true, JUMP_SLOT relocations are left to bind_lazy_slot(),
+     unless a symbol is also referenced by another relocation. */
+  void link_node::resolve_symbols(bool lazy)
+  {
+    unsigned int i;
+
     if (!has_relocations)
       return;
-    
+
     for (i = 0;
-	 i < dyn_relocs.get_size();
-	 i++) 
+         i < dyn_relocs.get_size();
+         i++)
       {
-	info = dyn_relocs.read_info(i);
-	symndx = ELF32_R_SYM(info);
-	elf_symbol = dyn_table.get_symbol(symndx);
-	symbol = new symbol_wrapper(elf_symbol, match_endian);
-	symbol_info = symbol->read_info();
-	
-	if (ELF32_ST_TYPE(symbol_info) > STT_FUNC &&
-	    ELF32_ST_TYPE(symbol_info) != STT_COMMON) {
-	  delete symbol;
-	  continue; /* Not a symbol type we need to resolve */
-	}
-	
-	if (ELF32_ST_BIND(symbol_info) == STB_LOCAL ||
-	    ELF32_ST_BIND(symbol_info) > STB_WEAK) {
-	  delete symbol;
-	  continue; /* Not global or weak */
-	}
-	
-	if (ELF32_ST_BIND(symbol_info) == STB_WEAK) {
-	  weak = 1;
-	}
-	
-	if (symbol->read_section_ndx() != SHN_UNDEF) {
-	    delete symbol;
-	    continue;  /* Symbol is not undefined, no need to resolve */
-	}
-	
-	vername = NULL;
-	verhash = 0;
-	/* Are we requesting a special version? */
-	if (dyn_table.get_verneed() != NULL)
-	  {
-	    Elf32_Half verndx = dyn_table.get_verndx(symndx);
-	    vername = dyn_table.get_verneed()->lookup_version(verndx & 0x7fff);
-	    verhash = dyn_table.get_verneed()->get_cur_hash();
-	  }
-	
-	def_elf_symbol = NULL;
-        def_elf_symbol = find_symbol(dyn_table.get_name(symbol->read_name_ndx()), vername, verhash, false);
-	
-	if (def_elf_symbol == NULL)  /* Symbol not found. */
-	  {
-	    if (weak) {
-	      delete symbol;
-	      continue; /* Definition for this symbol is not a problem */	      
-	    }
-	    AC_ERROR("Run-time dynamic linker: Symbol \"" << 
-		     dyn_table.get_name(symbol->read_name_ndx()) << "\" unknown.");
-	    exit(EXIT_FAILURE);
-	  }
-	
-	/* Symbol found */
-	def_symbol = new symbol_wrapper(def_elf_symbol, match_endian);
-	symbol->write_value(def_symbol->read_value());
-	symbol->write_size(def_symbol->read_size());
-	symbol->write_section_ndx(def_symbol->read_section_ndx());
-	symbol->write_info(def_symbol->read_info());
-	
-	/* Done */
-	delete def_symbol;
-	delete symbol;
-      } /* for(i=0;i<dyn_relocs.get_size();i++) */
+        unsigned reloc_type;
+        FETCH_RELOC_TYPE(dyn_relocs.read_info(i), reloc_type);
+        if (lazy && reloc_type == 3) /* JUMP_SLOT */
+          continue;
+        resolve_symbol(i);
+      }
   } /* resolve_symbols() */
 
-#define FETCH_RELOC_TYPE(a,b)                                              \
-        if (rtld_config != NULL) {                                         \
-          if (rtld_config->translate(ELF32_R_TYPE(a), &b)==-1)             \
-            {                                                              \
-              b = ELF32_R_TYPE(a);                                         \
-            }                                                              \
-        } else {                                                           \
-          b = ELF32_R_TYPE(a);                                             \
-        }
-
   Elf32_Addr link_node::find_copy_relocation(unsigned char *symname)
   {
     unsigned int i;
@@ -648,8 +690,12 @@ namespace ac_dynlink {
     }
   }
   
-  /* Walks through object's relocation entries and relocate. */
-  void link_node::apply_relocations(unsigned char *mem, unsigned char word_size)
+  /* Walks through object's relocation entries and relocate. If lazy_slots
+     is not NULL, JUMP_SLOT entries get the next trap address from
+     lazy_base instead of their symbol and are appended to lazy_slots. */
+  void link_node::apply_relocations(unsigned char *mem, unsigned char word_size,
+                                    std::vector<lazy_slot> *lazy_slots,
+                                    Elf32_Addr lazy_base)
   {
     unsigned int i, j, aux;
     Elf32_Word info;
@@ -702,11 +748,20 @@ namespace ac_dynlink {
             target_size = 8;
             patch_code(mem+location, target, target_size);
             break;
+	  case 3: /* JUMP_SLOT */
+            if (lazy_slots != NULL) {
+              lazy_slot slot = { this, i };
+              patch_code(mem+location, lazy_base + lazy_slots->size() * AC_RTLD_LAZY_STRIDE,
+                         target_size);
+              lazy_slots->push_back(slot);
+              break;
+            }
+            patch_code(mem+location, target, target_size);
+	    break;
 	  case 6: /* ABS16 */
             target_size = 16;
             /* Fall through */
           case 7: /* ABS32 */
-	  case 3: /* JUMP_SLOT */
 	  case 4: /* GLOB_DAT */
             patch_code(mem+location, target, target_size);
 	    break;
@@ -738,4 +793,39 @@ namespace ac_dynlink {
       } /* for(i=0;i<dyn_relocs.get_size();i++) */
   } /* apply_relocations() */
 
+  /* Number of JUMP_SLOT relocations of this object */
+  unsigned int link_node::count_jump_slots()
+  {
+    unsigned int i, n = 0;
+
+    if (!has_relocations)
+      return 0;
+
+    for (i = 0; i < dyn_relocs.get_size(); i++) {
+      unsigned reloc_type;
+      FETCH_RELOC_TYPE(dyn_relocs.read_info(i), reloc_type);
+      if (reloc_type == 3) /* JUMP_SLOT */
+        n++;
+    }
+    return n;
+  }
+
+  /* Resolves the symbol of JUMP_SLOT relocation i, left unbound by a lazy
+     apply_relocations(). Returns the target and, in slot, the guest
+     address of the slot. The caller patches the slot through the
+     simulator memory port, so that caches see it. */
+  Elf32_Addr link_node::bind_lazy_slot(unsigned int i, Elf32_Addr &slot)
+  {
+    Elf32_Addr target;
+    symbol_wrapper *symbol;
+
+    resolve_symbol(i);
+    symbol = new symbol_wrapper(dyn_table.get_symbol(ELF32_R_SYM(dyn_relocs.read_info(i))),
+                                match_endian);
+    target = symbol->read_value() + dyn_relocs.read_addend(i);
+    delete symbol;
+    slot = dyn_relocs.read_offset(i) + load_addr;
+    return target;
+  }
+
 }
@@ -45,106 +45,12 @@
 
 namespace ac_dynlink {
 
-  /*
-     memmap_node class methods
-   */
-  /* 
-     Default constructor
-   */
-  memmap_node::memmap_node(memmap_node * _next, memmap_status _status, Elf32_Addr _addr):
-    next(_next),
-    addr(_addr),
-    status(_status) {
-  }
-    
-  memmap_node* memmap_node::get_next() {
-    return next;
-  }
-    
-  Elf32_Addr memmap_node::get_addr() {
-    return addr;
-  }
-    
-  memmap_status memmap_node::get_status() {
-    return status;
-  }
-
-  void memmap_node::set_status(memmap_status value) {
-    status = value;
-  }
-
-  void memmap_node::set_next(memmap_node *next) {
-    this->next = next;
-  }
-   
-  /*
-     memmap class methods
-   */
-  void memmap::delete_node(memmap_node *node) {
-    memmap_node *aux = list, *prior = NULL;
-    
-    while (aux != NULL && aux != node){
-      prior = aux;
-      aux = aux->get_next();
-    }
-    if (node == list) {
-      aux = list->get_next();
-      delete list;
-      list = aux;
-    } else {
-      memmap_node *aux2 = aux->get_next();
-      delete aux;
-      prior->set_next(aux2);
-    }
-  }
-
-  void memmap::fix_consistency() {
-    memmap_node *aux = list->get_next(), *prior=list;
-    
-    /* fixes misplaced nodes */
-    while (aux != NULL) {
-      if (aux->get_addr() <= prior->get_addr() &&
-	  !(aux->get_status() == MS_FREE &&
-	    prior->get_status() == MS_FREE)) {
-	if (prior == list) {
-	  list = aux;
-          delete prior;
-        } else
-          delete_node(prior);
-      }
-      prior = aux;
-      aux = aux->get_next();
-    }
-    
-    /* merges contigous free block regions */
-    aux = list->get_next();
-    prior = list;
-    while (aux != NULL) {
-      if (aux->get_status() == MS_FREE &&
-	  prior->get_status() == MS_FREE) {
-	aux = aux->get_next();
-	delete_node(prior->get_next());
-      } else {
-	prior = aux;
-	aux = aux->get_next();
-      }
-    }    
-  }
-
-  void memmap::free_memmap() {
-    memmap_node *aux = list;
-    if (list == NULL)
-      return;
-    list = list->get_next();
-    delete aux;
-    free_memmap();
-  }
+#define ALIGN_ADDR(align) ((align) - ((align) % pagesize) + pagesize)
 
   /* 
      Default constructor
    */
   memmap::memmap() {
-      list = new memmap_node(NULL, MS_FREE, 0);
       pagesize = sysconf(_SC_PAGE_SIZE);
       brkaddr = 0;
       newbrkaddr = 0;
@@ -156,11 +62,71 @@ namespace ac_dynlink {
      Default destructor
    */
   memmap::~memmap() {
-    free_memmap();
+  }
+
+  /* Start of the gap before region next (the last gap for used.end()) */
+  Elf32_Addr memmap::gap_start(region_map::iterator next) {
+    if (next == used.begin())
+      return 0;
+    --next;
+    return next->second;
+  }
+
+  /* End of the gap before region next */
+  Elf32_Addr memmap::gap_end(region_map::iterator next) {
+    if (next == used.end())
+      return memsize;
+    return next->first;
+  }
+
+  void memmap::index_gap(Elf32_Addr start, Elf32_Addr end, bool insert) {
+    if (end <= start)
+      return;
+    if (insert)
+      gaps.insert(gap(end - start, start));
+    else
+      gaps.erase(gap(end - start, start));
+  }
+
+  /* Adds [start, end), which must lie inside a gap */
+  void memmap::insert_region(Elf32_Addr start, Elf32_Addr end) {
+    region_map::iterator next = used.upper_bound(start);
+    Elf32_Addr lo = gap_start(next), hi = gap_end(next);
+
+    index_gap(lo, hi, false);
+    index_gap(lo, start, true);
+    index_gap(end, hi, true);
+    used.insert(next, std::make_pair(start, end));
+  }
+
+  /* Removes a region, joining the gaps around it */
+  void memmap::erase_region(region_map::iterator region) {
+    region_map::iterator next = region;
+    Elf32_Addr lo = gap_start(region), hi;
+
+    ++next;
+    hi = gap_end(next);
+    index_gap(lo, region->first, false);
+    index_gap(region->second, hi, false);
+    index_gap(lo, hi, true);
+    used.erase(region);
+  }
+
+  void memmap::index_all_gaps() {
+    region_map::iterator it = used.begin();
+
+    gaps.clear();
+    for (;;) {
+      index_gap(gap_start(it), gap_end(it), true);
+      if (it == used.end())
+        break;
+      ++it;
+    }
   }
 
   void memmap::set_memsize(Elf32_Addr memsize) {
     this->memsize = memsize;
+    index_all_gaps();
   }
 
 
@@ -169,49 +135,63 @@ namespace ac_dynlink {
     newbrkaddr = addr;
   }
 
-  memmap_node *memmap::find_region (Elf32_Addr addr) {
-    memmap_node *aux = list;
-    
-    while (aux != NULL) {
-      if (aux->get_addr() == addr)
-	break;
-      aux = aux->get_next();
-    }
-    return aux;
-  }
+  /* Marks [start_addr, start_addr + size) as used, merging it with the
+     regions it overlaps or touches */
+  void memmap::add_region (Elf32_Addr start_addr, Elf32_Word size) {
+    Elf32_Addr end = start_addr + size;
+    region_map::iterator it;
 
-  memmap_node *memmap::add_region (Elf32_Addr start_addr, Elf32_Word size) {
-    memmap_node *aux = list, *prior = NULL;
-
-    if (start_addr + ((unsigned)size) > memsize) {
+    if (end > memsize || end < start_addr) {
       fprintf(stderr, "ArchC memory manager error: not enough memory in target.\n");
       fprintf(stderr, "  add_region failed: Start address = 0x%X ; Size = 0x%X",
               start_addr, size);
       fprintf(stderr, " ; Total Mem Size = 0x%X\n", memsize);
       exit(EXIT_FAILURE);
     }
-    
-    while (aux != NULL && aux->get_addr() < start_addr) {
-      prior = aux;
-      aux = aux->get_next();
-    }
-    
-    if (prior == NULL) {
-      prior = aux;
-      aux = aux->get_next();
+    if (size == 0)
+      return;
+
+    it = used.upper_bound(end);
+    while (it != used.begin()) {
+      region_map::iterator prior = it;
+      --prior;
+      if (prior->second < start_addr)
+        break;
+      if (prior->first < start_addr)
+        start_addr = prior->first;
+      if (prior->second > end)
+        end = prior->second;
+      erase_region(prior);
     }
-    
-    prior->set_next(new memmap_node(new memmap_node(aux, MS_FREE, start_addr+size), MS_USED, start_addr));
-    fix_consistency();
-    
-    return find_region(start_addr);
+    insert_region(start_addr, end);
   }
 
-#define ALIGN_ADDR(align) ((align) - ((align) % pagesize) + pagesize)
+  /* Marks [start_addr, start_addr + size) as free, splitting the regions
+     it covers partially */
+  void memmap::free_region (Elf32_Addr start_addr, Elf32_Word size) {
+    Elf32_Addr end = start_addr + size;
+    region_map::iterator it = used.lower_bound(end);
+
+    while (it != used.begin()) {
+      region_map::iterator prior = it;
+      Elf32_Addr first, last;
+      --prior;
+      first = prior->first;
+      last = prior->second;
+      if (last <= start_addr)
+        break;
+      erase_region(prior);
+      if (first < start_addr)
+        insert_region(first, start_addr);
+      if (last > end)
+        insert_region(end, last);
+      it = used.lower_bound(end);
+    }
+  }
 
   bool memmap::verify_region_availability(Elf32_Addr addr, Elf32_Word size, Elf32_Addr *next_addr)
   {
-    memmap_node *aux = list;
+    region_map::iterator it;
 
     if (addr <= ALIGN_ADDR(newbrkaddr)) {
       if (next_addr != NULL)
@@ -219,71 +199,79 @@ namespace ac_dynlink {
       return false;
     }
 
-    /* Finds the highest region address which is also lower or equal addr*/
-    while (aux->get_next() != NULL) {
-      if (aux->get_next()->get_addr() > addr)
-        break;
-      aux = aux->get_next();
-    }
     if (next_addr != NULL)
       *next_addr = 0;
-    if (aux->get_status() == MS_USED) {
-      if (next_addr != NULL && aux->get_next() != NULL)
-        *next_addr = aux->get_next()->get_addr();
-      return false; //  this region is occupied
-    } else if (aux->get_next() != NULL &&
-               aux->get_next()->get_status() == MS_USED) {
-      if (addr + ((unsigned)size) > aux->get_next()->get_addr()) {
-        if (next_addr != NULL && aux->get_next()->get_next() != NULL)
-          *next_addr = aux->get_next()->get_next()->get_addr();
-        return false; // not enough space
+    if (addr + ((unsigned)size) > memsize || addr + ((unsigned)size) < addr)
+      return false; // not enough space
+
+    /* The last region starting before the end of [addr, addr + size) */
+    it = used.lower_bound(addr + size);
+    if (it != used.begin()) {
+      --it;
+      if (it->second > addr) {
+        if (next_addr != NULL)
+          *next_addr = it->second;
+        return false; //  this region is occupied
       }
     }
-    if (addr + ((unsigned)size) > memsize)
-      return false; // not enough space
     return true;
   }
   
   Elf32_Addr memmap::suggest_free_region (Elf32_Word size) {
-    memmap_node *aux = list;
+    Elf32_Addr addr = used.empty() ? 0 : used.rbegin()->second;
 
-    while (aux->get_next() != NULL)
-      aux = aux->get_next();
-
-    if ((aux->get_addr() % pagesize) == 0)
-      return aux->get_addr();
+    if ((addr % pagesize) == 0)
+      return addr;
     else {
-      return ALIGN_ADDR(aux->get_addr());
+      return ALIGN_ADDR(addr);
     }
   }
 
   Elf32_Addr memmap::suggest_mmap_region(Elf32_Word size) {
-    /* Better suggest region far from stack and far from program break */
-    Elf32_Addr addr = ((memsize - newbrkaddr) >> 1) + newbrkaddr;
-    Elf32_Addr nextaddr;
-    bool loop = false;
-    addr = ALIGN_ADDR(addr);
-
-    /* Verify availability */
-    while (!verify_region_availability(addr, size, &nextaddr)) {
-      if (nextaddr != 0 && nextaddr + ((unsigned)size) < memsize)
-        addr = ALIGN_ADDR(nextaddr);
-      else if (!loop) {
-        loop = true;
-        addr = ALIGN_ADDR(brkaddr);
-      } else {
-        if (warning_display) {
-          fprintf(stderr, "ArchC memory manager warning: target ran out of memory - mmap call failed.\n");
-          warning_display = false;
-        }
-        return (Elf32_Addr)-1;
-      }
+    Elf32_Addr floor = ALIGN_ADDR(newbrkaddr), addr;
+    std::set<gap>::iterator g;
+    region_map::iterator above;
+
+    /* Best fit among the gaps left between regions above the program
+       break, such as the ones munmap frees */
+    for (g = gaps.lower_bound(gap(size, 0)); g != gaps.end(); ++g) {
+      Elf32_Addr end = g->second + g->first;
+      addr = (g->second % pagesize) ? ALIGN_ADDR(g->second) : g->second;
+      if (addr > floor && end < memsize && addr + ((unsigned)size) <= end)
+        return addr;
     }
-    return addr;
+
+    /* Otherwise far from stack and far from program break: halfway at
+       first, then above the highest region */
+    above = used.upper_bound(floor);
+    if (above == used.end())
+      addr = ALIGN_ADDR(((memsize - newbrkaddr) >> 1) + newbrkaddr);
+    else
+      addr = suggest_free_region(0);
+    if (verify_region_availability(addr, size, NULL))
+      return addr;
+
+    /* Last, the top of the space the program break grows into */
+    if (above != used.end() && above->first >= size) {
+      addr = above->first - size;
+      addr -= addr % pagesize;
+      if (verify_region_availability(addr, size, NULL))
+        return addr;
+    }
+
+    if (warning_display) {
+      fprintf(stderr, "ArchC memory manager warning: target ran out of memory - mmap call failed.\n");
+      warning_display = false;
+    }
+    return (Elf32_Addr)-1;
   }
 
   Elf32_Addr memmap::mmap_anon(Elf32_Addr addr, Elf32_Word size) {
 
+    /* Whole pages, as the host does */
+    if (size % pagesize != 0) {
+      size = ALIGN_ADDR(size);
+    }
     if (size == 0)
       return (Elf32_Addr) -1;
     
@@ -310,22 +298,20 @@ namespace ac_dynlink {
     return addr;
   }
 
+  /* Frees the pages in [addr, addr + size), whatever regions they
+     belong to, so the space can be handed out again */
   bool memmap::munmap(Elf32_Addr addr, Elf32_Word size) {
-    memmap_node* aux;
-    if (addr == 0)
+    if (addr == 0 || size == 0)
       return false;
     if (addr % pagesize != 0)
       return false;
-    aux = find_region (addr);
-    if (aux == NULL)
-      return false;
-    if (aux->get_next() != NULL) {
-      if (aux->get_next()->get_addr() - aux->get_addr() <= size)
-        {
-          aux->set_status(MS_FREE);
-          fix_consistency();
-        }
-    }
+    if (addr >= memsize)
+      return true;
+    if (size > memsize - addr)
+      size = memsize - addr;
+    else if (size % pagesize != 0)
+      size = ALIGN_ADDR(size);
+    free_region(addr, size);
 #ifdef DEBUG_MEMORY
     fprintf(stderr, "munmap region accepted: addr: %X size: %X brk: %X memsize: %X\n", addr, size, newbrkaddr, memsize);
 #endif
@@ -333,7 +319,7 @@ namespace ac_dynlink {
   }
 
   Elf32_Addr memmap::brk(Elf32_Addr addr) {
-    memmap_node *aux = list;
+    region_map::iterator above;
 
     if (addr <= brkaddr)
       return newbrkaddr;
@@ -352,14 +338,9 @@ namespace ac_dynlink {
     }
 
     /* Finds the lowest used region address which is also higher or equal newbrkaddr*/
-    while (aux != NULL) {
-      if (aux->get_addr() >= newbrkaddr && aux->get_status() == MS_USED)
-        break;
-      aux = aux->get_next();
-    }
-
-    if (aux != NULL) { 
-      if (addr >= aux->get_addr())
+    above = used.lower_bound(newbrkaddr);
+    if (above != used.end()) { 
+      if (addr >= above->first)
         return newbrkaddr;
     }
 
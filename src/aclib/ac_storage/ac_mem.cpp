@@ -31,17 +31,23 @@
  */
 
 #include "ac_mem.H"
+#include "ac_module.H"
 
 // constructor
 ac_mem::ac_mem(string nm, uint32_t sz) :
   name(nm),
-  size(sz) {
+  size(sz),
+  reserved(false) {
   data.ptr8 = new unsigned char[sz];
+  line_version = new std::atomic<uint32_t>[RESERVATION_LINES];
+  for (unsigned i = 0; i < RESERVATION_LINES; i++)
+    line_version[i] = 0;
 }
 
 // destructor
 ac_mem::~ac_mem() {
   delete[] data.ptr8;
+  delete[] line_version;
 }
 
 // getters and setters
@@ -111,6 +117,7 @@ void ac_mem::read(ac_ptr buf, uint32_t address,
 
 void ac_mem::write(const ac_ptr buf, uint32_t address,
 		       int wordsize) {
+  touch(address, wordsize / 8);
   switch (wordsize) {
   case 8: { // unsigned char
     (data.ptr8)[address] = *(buf.ptr8);
@@ -135,6 +142,7 @@ void ac_mem::write(const ac_ptr buf, uint32_t address,
 
 void ac_mem::write(const ac_ptr buf, uint32_t address,
 		       int wordsize, int n_words) {
+  touch(address, wordsize / 8 * n_words);
   switch (wordsize) {
   case 8: { // unsigned char
     for (int i = 0; i < n_words; i++)
@@ -196,14 +204,176 @@ void ac_mem::write(const ac_ptr buf, uint32_t address,
  * 
  */
 void ac_mem::lock()
-{} // empty == there's no point locking the internal storage
+{
+  // only cores on host threads can race: the kernel runs one at a time
+  if (ac_module::on_host_thread())
+    mutex.lock();
+}
 
 /** 
  * Unlocks the device.
  * 
  */
 void ac_mem::unlock()
-{} // empty == there's no point locking the internal storage
+{
+  if (ac_module::on_host_thread())
+    mutex.unlock();
+}
 
 //////////////////////////////////////////////////////////////////////////////
 
+// Atomic operations
+
+template <typename T>
+T ac_mem::atomic_fetch_op(ac_atomic_op op, T v, uint32_t address)
+{
+  T *p = word<T>(address);
+  switch (op) {
+  case AC_ATOMIC_SWAP: return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST);
+  case AC_ATOMIC_ADD:  return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST);
+  case AC_ATOMIC_AND:  return __atomic_fetch_and(p, v, __ATOMIC_SEQ_CST);
+  case AC_ATOMIC_OR:   return __atomic_fetch_or(p, v, __ATOMIC_SEQ_CST);
+  case AC_ATOMIC_XOR:  return __atomic_fetch_xor(p, v, __ATOMIC_SEQ_CST);
+  default:
+    break;
+  }
+  // min/max have no host instruction
+  T old = __atomic_load_n(p, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(p, &old, ac_atomic_apply(op, old, v), true,
+                                      __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    ;
+  return old;
+}
+
+/** 
+ * Compare-and-swap of a single word.
+ * 
+ */
+bool ac_mem::compare_and_swap(ac_ptr expected, const ac_ptr desired,
+                              uint32_t address, int wordsize,
+                              sc_core::sc_time &time_info, unsigned int procId)
+{
+  touch(address, wordsize / 8);
+  switch (wordsize) {
+  case 8:
+    return __atomic_compare_exchange_n(word<uint8_t>(address), expected.ptr8,
+                                       *desired.ptr8, false, __ATOMIC_SEQ_CST,
+                                       __ATOMIC_SEQ_CST);
+  case 16:
+    return __atomic_compare_exchange_n(word<uint16_t>(address), expected.ptr16,
+                                       *desired.ptr16, false, __ATOMIC_SEQ_CST,
+                                       __ATOMIC_SEQ_CST);
+  case 32:
+    return __atomic_compare_exchange_n(word<uint32_t>(address), expected.ptr32,
+                                       *desired.ptr32, false, __ATOMIC_SEQ_CST,
+                                       __ATOMIC_SEQ_CST);
+  case 64:
+    return __atomic_compare_exchange_n(word<uint64_t>(address), expected.ptr64,
+                                       *desired.ptr64, false, __ATOMIC_SEQ_CST,
+                                       __ATOMIC_SEQ_CST);
+  default: // weird size
+    return false;
+  }
+}
+
+/** 
+ * Read-modify-write of a single word.
+ * 
+ */
+void ac_mem::fetch_op(ac_atomic_op op, ac_ptr buf, uint32_t address,
+                      int wordsize, sc_core::sc_time &time_info,
+                      unsigned int procId)
+{
+  touch(address, wordsize / 8);
+  switch (wordsize) {
+  case 8:
+    *(buf.ptr8) = atomic_fetch_op(op, *(buf.ptr8), address);
+    break;
+  case 16:
+    *(buf.ptr16) = atomic_fetch_op(op, *(buf.ptr16), address);
+    break;
+  case 32:
+    *(buf.ptr32) = atomic_fetch_op(op, *(buf.ptr32), address);
+    break;
+  case 64:
+    *(buf.ptr64) = atomic_fetch_op(op, *(buf.ptr64), address);
+    break;
+  default: // weird size
+    break;
+  }
+}
+
+/** 
+ * Load-reserved: the reservation is the version of the line.
+ * 
+ */
+void ac_mem::load_reserved(ac_ptr buf, uint32_t address, int wordsize,
+                           uint32_t &tag, sc_core::sc_time &time_info,
+                           unsigned int procId)
+{
+  if (!reserved.load(std::memory_order_relaxed))
+    reserved.store(true);
+  tag = line(address).load();
+  switch (wordsize) {
+  case 8:  *(buf.ptr8) = __atomic_load_n(word<uint8_t>(address), __ATOMIC_SEQ_CST); break;
+  case 16: *(buf.ptr16) = __atomic_load_n(word<uint16_t>(address), __ATOMIC_SEQ_CST); break;
+  case 32: *(buf.ptr32) = __atomic_load_n(word<uint32_t>(address), __ATOMIC_SEQ_CST); break;
+  case 64: *(buf.ptr64) = __atomic_load_n(word<uint64_t>(address), __ATOMIC_SEQ_CST); break;
+  default: // weird size
+    break;
+  }
+}
+
+/** 
+ * Store-conditional: claims the line version seen by load_reserved(),
+ * then swaps the word if it still holds the value loaded. A write
+ * between the two steps is caught by the compare-and-swap.
+ * 
+ */
+bool ac_mem::store_conditional(const ac_ptr loaded, const ac_ptr buf,
+                               uint32_t address, int wordsize, uint32_t tag,
+                               sc_core::sc_time &time_info, unsigned int procId)
+{
+  if (!line(address).compare_exchange_strong(tag, tag + 1))
+    return false;
+
+  uint64_t expected;
+  memcpy(&expected, loaded.ptr8, wordsize / 8);
+  ac_ptr e(&expected);
+  switch (wordsize) {
+  case 8:
+    return __atomic_compare_exchange_n(word<uint8_t>(address), e.ptr8,
+                                       *buf.ptr8, false, __ATOMIC_SEQ_CST,
+                                       __ATOMIC_SEQ_CST);
+  case 16:
+    return __atomic_compare_exchange_n(word<uint16_t>(address), e.ptr16,
+                                       *buf.ptr16, false, __ATOMIC_SEQ_CST,
+                                       __ATOMIC_SEQ_CST);
+  case 32:
+    return __atomic_compare_exchange_n(word<uint32_t>(address), e.ptr32,
+                                       *buf.ptr32, false, __ATOMIC_SEQ_CST,
+                                       __ATOMIC_SEQ_CST);
+  case 64:
+    return __atomic_compare_exchange_n(word<uint64_t>(address), e.ptr64,
+                                       *buf.ptr64, false, __ATOMIC_SEQ_CST,
+                                       __ATOMIC_SEQ_CST);
+  default: // weird size
+    return false;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+// Direct access
+
+uint8_t *ac_mem::get_host_ptr(uint32_t address, uint32_t size, bool write)
+{
+  if (address > this->size || size > this->size - address)
+    return NULL;
+  if (write)
+    touch(address, size);
+  return data.ptr8 + address;
+}
+
+//////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,628 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/**
+ * @file      ac_vfs.cpp
+ *
+ * @author    The ArchC Team
+ *            http://www.archc.org/
+ *
+ *            Computer Systems Laboratory (LSC)
+ *            IC-UNICAMP
+ *            http://www.lsc.ic.unicamp.br/
+ *
+ * @version   1.0
+ *
+ * @brief     Guest file system layer of the syscall emulation
+ *
+ * @attention Copyright (C) 2002-2009 --- The ArchC Team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ac_vfs.H"
+
+ac_vfs ac_guest_vfs;
+
+ac_vfs::ac_vfs() : enabled(false) {
+}
+
+ac_vfs::~ac_vfs() {
+  std::set<open_file *> open_files(fds.begin(), fds.end());
+  for (std::set<open_file *>::iterator it = open_files.begin();
+       it != open_files.end(); ++it)
+    delete *it;
+  for (unsigned i = 0; i < archives.size(); i++)
+    munmap(archives[i].first, archives[i].second);
+}
+
+/* Drops empty and "." components and repeated slashes. ".." is kept,
+   the guest has no symbolic links here to resolve it against. */
+std::string ac_vfs::normalize(const char *path) {
+  std::string out;
+  if (*path == '/')
+    out = "/";
+  while (*path) {
+    while (*path == '/')
+      path++;
+    const char *end = strchr(path, '/');
+    if (end == NULL)
+      end = path + strlen(path);
+    if (end > path && !(end - path == 1 && *path == '.')) {
+      if (!out.empty() && out[out.size() - 1] != '/')
+        out += '/';
+      out.append(path, end);
+    }
+    path = end;
+  }
+  return out;
+}
+
+/* Whether path is dir or inside it. The empty dir holds relative paths */
+bool ac_vfs::under(const std::string &path, const std::string &dir) {
+  if (dir.empty())
+    return path.empty() || path[0] != '/';
+  if (dir == "/")
+    return path[0] == '/';
+  return path.compare(0, dir.size(), dir) == 0 &&
+         (path.size() == dir.size() || path[dir.size()] == '/');
+}
+
+void ac_vfs::add_dirs(const std::string &path) {
+  for (size_t pos = path.find('/', 1); pos != std::string::npos;
+       pos = path.find('/', pos + 1))
+    dirs.insert(path.substr(0, pos));
+}
+
+bool ac_vfs::in_scratch(const std::string &path) const {
+  for (unsigned i = 0; i < scratch_dirs.size(); i++)
+    if (under(path, scratch_dirs[i]))
+      return true;
+  return false;
+}
+
+bool ac_vfs::owns(const std::string &path) const {
+  return files.count(path) || dirs.count(path) || in_scratch(path);
+}
+
+/* Host path of a guest path not kept in memory (p is it normalized) */
+std::string ac_vfs::host_path(const char *path, const std::string &p) const {
+  for (unsigned i = 0; i < maps.size(); i++) {
+    const std::string &dir = maps[i].first;
+    if (under(p, dir))
+      return maps[i].second + (dir == "/" ? p : p.substr(dir.size()));
+  }
+  return path;
+}
+
+ac_vfs::open_file *ac_vfs::get(int fd) {
+  unsigned idx = fd - AC_VFS_FD_BASE;
+  if (fd < AC_VFS_FD_BASE || idx >= fds.size())
+    return NULL;
+  return fds[idx];
+}
+
+int ac_vfs::new_fd(open_file *f) {
+  for (unsigned i = 0; i < fds.size(); i++)
+    if (fds[i] == NULL) {
+      fds[i] = f;
+      return AC_VFS_FD_BASE + i;
+    }
+  fds.push_back(f);
+  return AC_VFS_FD_BASE + fds.size() - 1;
+}
+
+void ac_vfs::fill_stat(const node *n, struct stat *buf) const {
+  memset(buf, 0, sizeof(struct stat));
+  buf->st_ino = (ino_t) (size_t) n;
+  buf->st_mode = n->mode;
+  buf->st_nlink = 1;
+  buf->st_uid = getuid();
+  buf->st_gid = getgid();
+  buf->st_size = n->size;
+  buf->st_blksize = 4096;
+  buf->st_blocks = (n->size + 511) / 512;
+  buf->st_atime = buf->st_mtime = buf->st_ctime = n->mtime;
+}
+
+void ac_vfs::fill_dir_stat(struct stat *buf) const {
+  memset(buf, 0, sizeof(struct stat));
+  buf->st_mode = S_IFDIR | 0755;
+  buf->st_nlink = 2;
+  buf->st_uid = getuid();
+  buf->st_gid = getgid();
+  buf->st_blksize = 4096;
+}
+
+int ac_vfs::stat_path(const char *path, struct stat *buf, bool follow) {
+  std::string p = normalize(path);
+  if (!owns(p)) {
+    std::string host = host_path(path, p);
+    return follow ? ::stat(host.c_str(), buf) : ::lstat(host.c_str(), buf);
+  }
+  std::map<std::string, node>::const_iterator it = files.find(p);
+  if (it != files.end())
+    fill_stat(&it->second, buf);
+  else if (dirs.count(p))
+    fill_dir_stat(buf);
+  else {
+    errno = ENOENT;
+    return -1;
+  }
+  return 0;
+}
+
+/*
+  Options
+*/
+
+static unsigned long tar_number(const char *field, unsigned len) {
+  unsigned long value = 0;
+  unsigned i = 0;
+  while (i < len && field[i] == ' ')
+    i++;
+  for (; i < len && field[i] >= '0' && field[i] <= '7'; i++)
+    value = value * 8 + (field[i] - '0');
+  return value;
+}
+
+/* Maps a tar archive (ustar, with GNU long names) and indexes its
+   regular files and directories. Other entries are skipped. */
+bool ac_vfs::add_archive(const char *file, const char *dir) {
+  int fd = ::open(file, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || ::fstat(fd, &st) < 0) {
+    fprintf(stderr, "ArchC ERROR: Cannot open archive %s: %s\n", file,
+            strerror(errno));
+    if (fd >= 0)
+      ::close(fd);
+    return false;
+  }
+  size_t size = st.st_size;
+  void *base = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+  ::close(fd);
+  if (base == MAP_FAILED) {
+    fprintf(stderr, "ArchC ERROR: Cannot map archive %s: %s\n", file,
+            strerror(errno));
+    return false;
+  }
+  if (base != NULL)
+    archives.push_back(std::make_pair(base, size));
+
+  std::string mount = normalize(dir);
+  if (!mount.empty()) {
+    dirs.insert(mount);
+    add_dirs(mount);
+  }
+
+  const unsigned char *p = (const unsigned char *) base;
+  const unsigned char *end = p + size;
+  std::string long_name;
+  while (p + 512 <= end && p[0] != 0) {
+    const char *header = (const char *) p;
+    unsigned long fsize = tar_number(header + 124, 12);
+    char type = header[156];
+    const unsigned char *data = p + 512;
+    if (fsize > (unsigned long) (end - data)) {
+      fprintf(stderr, "ArchC ERROR: Archive %s is truncated\n", file);
+      return false;
+    }
+
+    std::string name;
+    if (!long_name.empty()) {
+      name.swap(long_name);
+    } else {
+      if (!memcmp(header + 257, "ustar", 5) && header[345])
+        name.assign(header + 345, strnlen(header + 345, 155)).append("/");
+      name.append(header, strnlen(header, 100));
+    }
+    name = normalize(name.c_str());
+    std::string key =
+        mount.empty() ? name : normalize((mount + "/" + name).c_str());
+
+    if (type == 'L') {
+      long_name.assign((const char *) data, strnlen((const char *) data, fsize));
+    } else if (type == '0' || type == '\0' || type == '7') {
+      node &n = files[key];
+      n.data = data;
+      n.buf.clear();
+      n.size = fsize;
+      n.mode = S_IFREG | (tar_number(header + 100, 8) & 07777);
+      n.mtime = tar_number(header + 136, 12);
+      n.scratch = false;
+      add_dirs(key);
+    } else if (type == '5' && !key.empty()) {
+      dirs.insert(key);
+      add_dirs(key);
+    }
+    p = data + ((fsize + 511) & ~511UL);
+  }
+  enabled = true;
+  return true;
+}
+
+bool ac_vfs::add_scratch(const char *dir) {
+  std::string d = normalize(dir);
+  if (d.empty())
+    return false;
+  scratch_dirs.push_back(d);
+  dirs.insert(d);
+  add_dirs(d);
+  enabled = true;
+  return true;
+}
+
+bool ac_vfs::add_map(const char *dir, const char *host_dir) {
+  std::string d = normalize(dir);
+  std::string h = normalize(host_dir);
+  if (d.empty() || h.empty())
+    return false;
+  if (h == "/")
+    h.clear();
+  unsigned i = 0;
+  while (i < maps.size() && maps[i].first.size() >= d.size())
+    i++;
+  maps.insert(maps.begin() + i, std::make_pair(d, h));
+  enabled = true;
+  return true;
+}
+
+/*
+  File syscalls
+*/
+
+int ac_vfs::open(const char *path, int flags, int mode) {
+  if (!enabled)
+    return ::open(path, flags, mode);
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  std::string p = normalize(path);
+  if (!owns(p))
+    return ::open(host_path(path, p).c_str(), flags, mode);
+
+  std::map<std::string, node>::iterator it = files.find(p);
+  bool writing = (flags & O_ACCMODE) != O_RDONLY;
+  if (it == files.end()) {
+    if (dirs.count(p) || !(flags & O_CREAT) || !in_scratch(p)) {
+      errno = dirs.count(p) ? EISDIR : ENOENT;
+      return -1;
+    }
+    node &n = files[p];
+    n.data = NULL;
+    n.size = 0;
+    n.mode = S_IFREG | (mode & 0777);
+    n.mtime = time(NULL);
+    n.scratch = true;
+    add_dirs(p);
+    it = files.find(p);
+  } else if ((flags & O_CREAT) && (flags & O_EXCL)) {
+    errno = EEXIST;
+    return -1;
+  }
+
+  node &n = it->second;
+  if (writing && !n.scratch) {
+    if (!in_scratch(p)) {
+      errno = EROFS;
+      return -1;
+    }
+    // Copy on write from the archive
+    n.buf.assign(n.data, n.data + n.size);
+    n.scratch = true;
+  }
+  if (writing && (flags & O_TRUNC)) {
+    n.buf.clear();
+    n.size = 0;
+  }
+
+  open_file *f = new open_file;
+  f->file = &n;
+  f->offset = 0;
+  f->flags = flags;
+  f->refs = 1;
+  return new_fd(f);
+}
+
+int ac_vfs::creat(const char *path, int mode) {
+  return open(path, O_CREAT | O_WRONLY | O_TRUNC, mode);
+}
+
+int ac_vfs::close(int fd) {
+  if (!enabled || fd < AC_VFS_FD_BASE)
+    return ::close(fd);
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  open_file *f = get(fd);
+  if (f == NULL)
+    return ::close(fd);
+  fds[fd - AC_VFS_FD_BASE] = NULL;
+  if (--f->refs == 0)
+    delete f;
+  return 0;
+}
+
+ssize_t ac_vfs::read(int fd, void *buf, size_t count) {
+  if (!enabled || fd < AC_VFS_FD_BASE)
+    return ::read(fd, buf, count);
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  open_file *f = get(fd);
+  if (f == NULL)
+    return ::read(fd, buf, count);
+  if ((f->flags & O_ACCMODE) == O_WRONLY) {
+    errno = EBADF;
+    return -1;
+  }
+  node *n = f->file;
+  if ((size_t) f->offset >= n->size)
+    return 0;
+  if (count > n->size - f->offset)
+    count = n->size - f->offset;
+  memcpy(buf, (n->scratch ? &n->buf[0] : n->data) + f->offset, count);
+  f->offset += count;
+  return count;
+}
+
+ssize_t ac_vfs::write(int fd, const void *buf, size_t count) {
+  if (!enabled || fd < AC_VFS_FD_BASE)
+    return ::write(fd, buf, count);
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  open_file *f = get(fd);
+  if (f == NULL)
+    return ::write(fd, buf, count);
+  if ((f->flags & O_ACCMODE) == O_RDONLY) {
+    errno = EBADF;
+    return -1;
+  }
+  node *n = f->file;
+  if (f->flags & O_APPEND)
+    f->offset = n->size;
+  if (f->offset + count > n->buf.size())
+    n->buf.resize(f->offset + count);
+  if (count)
+    memcpy(&n->buf[f->offset], buf, count);
+  n->size = n->buf.size();
+  f->offset += count;
+  return count;
+}
+
+ssize_t ac_vfs::readv(int fd, const struct iovec *iov, int iovcnt) {
+  if (!enabled || fd < AC_VFS_FD_BASE)
+    return ::readv(fd, iov, iovcnt);
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  if (get(fd) == NULL)
+    return ::readv(fd, iov, iovcnt);
+  ssize_t total = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    ssize_t ret = read(fd, iov[i].iov_base, iov[i].iov_len);
+    if (ret < 0)
+      return total ? total : ret;
+    total += ret;
+    if ((size_t) ret < iov[i].iov_len)
+      break;
+  }
+  return total;
+}
+
+ssize_t ac_vfs::writev(int fd, const struct iovec *iov, int iovcnt) {
+  if (!enabled || fd < AC_VFS_FD_BASE)
+    return ::writev(fd, iov, iovcnt);
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  if (get(fd) == NULL)
+    return ::writev(fd, iov, iovcnt);
+  ssize_t total = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    ssize_t ret = write(fd, iov[i].iov_base, iov[i].iov_len);
+    if (ret < 0)
+      return total ? total : ret;
+    total += ret;
+  }
+  return total;
+}
+
+off_t ac_vfs::lseek(int fd, off_t offset, int whence) {
+  if (!enabled || fd < AC_VFS_FD_BASE)
+    return ::lseek(fd, offset, whence);
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  open_file *f = get(fd);
+  if (f == NULL)
+    return ::lseek(fd, offset, whence);
+  off_t pos;
+  switch (whence) {
+  case SEEK_SET: pos = offset; break;
+  case SEEK_CUR: pos = f->offset + offset; break;
+  case SEEK_END: pos = f->file->size + offset; break;
+  default: pos = -1;
+  }
+  if (pos < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  f->offset = pos;
+  return pos;
+}
+
+int ac_vfs::dup(int fd) {
+  if (!enabled || fd < AC_VFS_FD_BASE)
+    return ::dup(fd);
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  open_file *f = get(fd);
+  if (f == NULL)
+    return ::dup(fd);
+  f->refs++;
+  return new_fd(f);
+}
+
+/* Files in memory can only be duplicated to descriptors in their range */
+int ac_vfs::dup2(int fd, int newfd) {
+  if (!enabled)
+    return ::dup2(fd, newfd);
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  open_file *f = get(fd);
+  if (f == NULL && get(newfd) == NULL)
+    return ::dup2(fd, newfd);
+  if (f == NULL || newfd < AC_VFS_FD_BASE) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (fd == newfd)
+    return newfd;
+  if (get(newfd) != NULL)
+    close(newfd);
+  unsigned idx = newfd - AC_VFS_FD_BASE;
+  if (idx >= fds.size())
+    fds.resize(idx + 1, NULL);
+  f->refs++;
+  fds[idx] = f;
+  return newfd;
+}
+
+int ac_vfs::isatty(int fd) {
+  if (!enabled || fd < AC_VFS_FD_BASE)
+    return ::isatty(fd);
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  if (get(fd) == NULL)
+    return ::isatty(fd);
+  errno = ENOTTY;
+  return 0;
+}
+
+int ac_vfs::access(const char *path, int mode) {
+  if (!enabled)
+    return ::access(path, mode);
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  struct stat buf;
+  std::string p = normalize(path);
+  if (!owns(p))
+    return ::access(host_path(path, p).c_str(), mode);
+  if (stat_path(path, &buf, true) < 0)
+    return -1;
+  if ((mode & W_OK) && !in_scratch(p)) {
+    errno = EROFS;
+    return -1;
+  }
+  if ((mode & X_OK) && !(buf.st_mode & 0111)) {
+    errno = EACCES;
+    return -1;
+  }
+  return 0;
+}
+
+int ac_vfs::chmod(const char *path, mode_t mode) {
+  if (!enabled)
+    return ::chmod(path, mode);
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  std::string p = normalize(path);
+  if (!owns(p))
+    return ::chmod(host_path(path, p).c_str(), mode);
+  std::map<std::string, node>::iterator it = files.find(p);
+  if (it == files.end() || !it->second.scratch) {
+    errno = it == files.end() && !dirs.count(p) ? ENOENT : EROFS;
+    return -1;
+  }
+  it->second.mode = S_IFREG | (mode & 07777);
+  return 0;
+}
+
+int ac_vfs::stat(const char *path, struct stat *buf) {
+  if (!enabled)
+    return ::stat(path, buf);
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  return stat_path(path, buf, true);
+}
+
+int ac_vfs::lstat(const char *path, struct stat *buf) {
+  if (!enabled)
+    return ::lstat(path, buf);
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  return stat_path(path, buf, false);
+}
+
+int ac_vfs::fstat(int fd, struct stat *buf) {
+  if (!enabled || fd < AC_VFS_FD_BASE)
+    return ::fstat(fd, buf);
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  open_file *f = get(fd);
+  if (f == NULL)
+    return ::fstat(fd, buf);
+  fill_stat(f->file, buf);
+  return 0;
+}
+
+#define COPY_STAT64(from, to)                   \
+  do {                                          \
+    memset(to, 0, sizeof(struct stat64));       \
+    (to)->st_dev = (from).st_dev;               \
+    (to)->st_ino = (from).st_ino;               \
+    (to)->st_mode = (from).st_mode;             \
+    (to)->st_nlink = (from).st_nlink;           \
+    (to)->st_uid = (from).st_uid;               \
+    (to)->st_gid = (from).st_gid;               \
+    (to)->st_size = (from).st_size;             \
+    (to)->st_blksize = (from).st_blksize;       \
+    (to)->st_blocks = (from).st_blocks;         \
+    (to)->st_atime = (from).st_atime;           \
+    (to)->st_mtime = (from).st_mtime;           \
+    (to)->st_ctime = (from).st_ctime;           \
+  } while(0)
+
+int ac_vfs::stat64(const char *path, struct stat64 *buf) {
+  struct stat s;
+  if (!enabled)
+    return ::stat64(path, buf);
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  std::string p = normalize(path);
+  if (!owns(p))
+    return ::stat64(host_path(path, p).c_str(), buf);
+  if (stat_path(path, &s, true) < 0)
+    return -1;
+  COPY_STAT64(s, buf);
+  return 0;
+}
+
+int ac_vfs::lstat64(const char *path, struct stat64 *buf) {
+  struct stat s;
+  if (!enabled)
+    return ::lstat64(path, buf);
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  std::string p = normalize(path);
+  if (!owns(p))
+    return ::lstat64(host_path(path, p).c_str(), buf);
+  if (stat_path(path, &s, false) < 0)
+    return -1;
+  COPY_STAT64(s, buf);
+  return 0;
+}
+
+int ac_vfs::fstat64(int fd, struct stat64 *buf) {
+  struct stat s;
+  if (!enabled || fd < AC_VFS_FD_BASE)
+    return ::fstat64(fd, buf);
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  open_file *f = get(fd);
+  if (f == NULL)
+    return ::fstat64(fd, buf);
+  fill_stat(f->file, &s);
+  COPY_STAT64(s, buf);
+  return 0;
+}
+
+#undef COPY_STAT64
@@ -19,6 +19,8 @@
 //////////////////////////////////////////////////////////////////////////////
 
 // Standard includes
+#include <cstdio>
+#include <vector>
 
 // SystemC includes
 
@@ -26,6 +28,7 @@
 #include<tlm.h>
 #include "ac_tlm2_intr_port.H"
 #include "ac_tlm2_payload.H"
+#include "ac_module.H"
 
 //////////////////////////////////////////////////////////////////////////////
 
@@ -48,9 +51,14 @@ using tlm::TLM_READ_COMMAND;
  * @param hnd Interrupt handler for this port.
  *
  */
-ac_tlm2_intr_port::ac_tlm2_intr_port(char const* nm, ac_intr_handler& hnd) :
+ac_tlm2_intr_port::ac_tlm2_intr_port(char const* nm, ac_intr_handler& hnd,
+                                     unsigned int queue_size) :
   handler(hnd),
-  name(nm)
+  queue(queue_size),
+  delivered(0),
+  coalesced(0),
+  name(nm),
+  interrupts(0)
   {
     bind(*this);
   }
@@ -85,7 +93,16 @@ void ac_tlm2_intr_port::b_transport(ac_tlm2_payload &payload, sc_core::sc_time &
   switch( command )
   {
     case TLM_WRITE_COMMAND:    
-      handler.handle(data_p,addr);       
+      interrupts++;
+      if (!intr_owner) {
+        // while parallel cores run, delivery waits for the quantum boundary
+        ac_module::defer_to_sync([this, data_p, addr]() { handler.handle(data_p, addr); });
+      }
+      else {
+        ac_intr_queue::entry e = { data_p, addr, sc_time_stamp() };
+        if (queue.push(e) && !ac_module::on_host_thread())
+          intr_owner->intr_posted();
+      }
       payload.set_response_status(tlm::TLM_OK_RESPONSE);
       break;
     
@@ -94,6 +111,60 @@ void ac_tlm2_intr_port::b_transport(ac_tlm2_payload &payload, sc_core::sc_time &
     }
 }
 
+/**
+ * Delivers the pending interrupts, in arrival order. An interrupt equal
+ * (value and address) to one already delivered by this drain is
+ * coalesced.
+ *
+ * @return False if no interrupt was pending.
+ *
+ */
+bool ac_tlm2_intr_port::drain_interrupts()
+{
+  if (queue.empty())
+    return false;
+
+  std::vector<ac_intr_queue::entry> batch;
+  ac_intr_queue::entry e;
+  while (queue.pop(e)) {
+    sc_time latency = sc_time_stamp() - e.posted;
+    total_latency += latency;
+    if (latency > max_latency)
+      max_latency = latency;
+
+    unsigned int i;
+    for (i = 0; i < batch.size(); i++)
+      if (batch[i].value == e.value && batch[i].addr == e.addr)
+        break;
+    if (i < batch.size())
+      coalesced++;
+    else
+      batch.push_back(e);
+  }
+
+  for (unsigned int i = 0; i < batch.size(); i++) {
+    delivered++;
+    handler.handle(batch[i].value, batch[i].addr);
+  }
+  return true;
+}
+
+/**
+ * Prints the delivery statistics.
+ *
+ */
+void ac_tlm2_intr_port::PrintIntrStat()
+{
+  unsigned long long queued = delivered + coalesced;
+  fprintf(stderr, "    Interrupts (%s): %llu received, %llu delivered, "
+          "%llu coalesced, %llu dropped (queue: %u)\n", name.c_str(),
+          interrupts, delivered, coalesced, queue.dropped(), queue.size());
+  if (queued)
+    fprintf(stderr, "    Delivery latency: average %.1f ns, max %.1f ns\n",
+            total_latency.to_seconds() * 1e9 / queued,
+            max_latency.to_seconds() * 1e9);
+}
+
 //////////////////////////////////////////////////////////////////////////////
 
 // Destructors
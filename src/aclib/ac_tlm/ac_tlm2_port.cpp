@@ -38,13 +38,14 @@
 // ArchC includes
 #include "ac_tlm2_port.H"
 #include "ac_tlm2_payload.H"
+#include "ac_module.H"
 
 // If you want to debug TLM 2.0, please uncomment the next line
 //#define debugTLM2
 
 // Constructors
 
-ac_tlm2_port::ac_tlm2_port(char const* nm, uint32_t sz) : name(nm), size(sz) {
+ac_tlm2_port::ac_tlm2_port(char const* nm, uint32_t sz) : name(nm), size(sz), transactions(0) {
 
  payload = new ac_tlm2_payload();
  
@@ -58,6 +59,13 @@ ac_tlm2_port::ac_tlm2_port(char const* nm, uint32_t sz) : name(nm), size(sz) {
  */
 void ac_tlm2_port::read(ac_ptr buf, uint32_t address, int wordsize,sc_core::sc_time& time_info, unsigned int procId)
 {
+    // parallel cores reach the bus through the kernel
+    if (ac_module::on_host_thread()) {
+      ac_module::kernel_call([&]() { read(buf, address, wordsize, time_info, procId); });
+      return;
+    }
+    transactions++;
+
     //sc_core::sc_time time_info;
     unsigned char buffer[64];
 
@@ -137,6 +145,12 @@ void ac_tlm2_port::read(ac_ptr buf, uint32_t address, int wordsize,sc_core::sc_t
 
 void ac_tlm2_port::read(ac_ptr buf, uint32_t address,
                          int wordsize, int n_words,sc_core::sc_time &time_info,unsigned int procId) {
+    // parallel cores reach the bus through the kernel
+    if (ac_module::on_host_thread()) {
+      ac_module::kernel_call([&]() { read(buf, address, wordsize, n_words, time_info, procId); });
+      return;
+    }
+    transactions++;
 
     //sc_core::sc_time time_info = sc_core::sc_time(0, SC_NS);
     payload->set_command(tlm::TLM_READ_COMMAND);
@@ -225,6 +239,12 @@ void ac_tlm2_port::read(ac_ptr buf, uint32_t address,
  * 
   */
 void ac_tlm2_port::write(ac_ptr buf, uint32_t address, int wordsize,sc_core::sc_time &time_info,unsigned int procId) {
+    // parallel cores reach the bus through the kernel
+    if (ac_module::on_host_thread()) {
+      ac_module::kernel_call([&]() { write(buf, address, wordsize, time_info, procId); });
+      return;
+    }
+    transactions++;
 
   //sc_core::sc_time time_info = sc_core::sc_time(0, SC_NS);
 
@@ -321,6 +341,12 @@ void ac_tlm2_port::write(ac_ptr buf, uint32_t address, int wordsize,sc_core::sc_
  */
 void ac_tlm2_port::write(ac_ptr buf, uint32_t address,
                          int wordsize, int n_words,sc_core::sc_time &time_info,unsigned int procId) {
+    // parallel cores reach the bus through the kernel
+    if (ac_module::on_host_thread()) {
+      ac_module::kernel_call([&]() { write(buf, address, wordsize, n_words, time_info, procId); });
+      return;
+    }
+    transactions++;
 
   //sc_core::sc_time time_info = sc_core::sc_time(0, SC_NS);
   payload->set_command(tlm::TLM_WRITE_COMMAND);
@@ -385,6 +411,42 @@ void ac_tlm2_port::unlock()
     exit(0);
 }
 
+/** 
+ * Compare-and-swap of a single word.
+ * 
+ */
+bool ac_tlm2_port::compare_and_swap(ac_ptr expected, const ac_ptr desired,
+                                    uint32_t address, int wordsize,
+                                    sc_core::sc_time &time_info,
+                                    unsigned int procId)
+{
+    if (ac_module::on_host_thread()) {
+      bool ok;
+      ac_module::kernel_call([&]() {
+        ok = ac_inout_if::compare_and_swap(expected, desired, address, wordsize, time_info, procId);
+      });
+      return ok;
+    }
+    return ac_inout_if::compare_and_swap(expected, desired, address, wordsize, time_info, procId);
+}
+
+/** 
+ * Read-modify-write of a single word.
+ * 
+ */
+void ac_tlm2_port::fetch_op(ac_atomic_op op, ac_ptr buf, uint32_t address,
+                            int wordsize, sc_core::sc_time &time_info,
+                            unsigned int procId)
+{
+    if (ac_module::on_host_thread()) {
+      ac_module::kernel_call([&]() {
+        ac_inout_if::fetch_op(op, buf, address, wordsize, time_info, procId);
+      });
+      return;
+    }
+    ac_inout_if::fetch_op(op, buf, address, wordsize, time_info, procId);
+}
+
 //////////////////////////////////////////////////////////////////////////////
 
 // Destructors
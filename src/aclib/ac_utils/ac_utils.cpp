@@ -61,6 +61,16 @@ bool ac_do_trace;
 char *appfilename = NULL;
 std::map<std::string, std::ofstream*> ac_cache_traces;
 
+//Syscall log files (--syscall-record / --syscall-replay), see ac_syscall.H
+char *ac_syscall_record_file = NULL;
+char *ac_syscall_replay_file = NULL;
+//Number of ac_syscall objects built, for the log suffix of each processor
+int ac_syscall_instances = 0;
+
+//Guest time from the modeled time (--virtual-time), see ac_syscall.H
+bool ac_virtual_time = false;
+long long ac_virtual_epoch = 0;
+
 
 unsigned int convert_endian(unsigned int size, unsigned int num, bool match_endian)
 {
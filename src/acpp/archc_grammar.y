@@ -937,7 +937,7 @@ cacheobjdec: ID COLON INT unit /* Generic cache. Just a container for data */
       /* Parameters for ac_cache instantiation may be interdependent, for example,
          replacement strategy only makes sense for non-directed-mapped caches. So, put all
          given parameters in a list and let the simulator generator take care of this analisys.
-         We may have 5 or 6 parameters.*/
+         We may have 5 or 6 parameters (the 6th one selects a prefetcher).*/
              /* associativity        nblocks         blocksize        replacestrtgy/writemethod          */
       | ID LPAREN cachesparm COMMA cachenparm COMMA cachenparm COMMA cachesparm COMMA cachesparm cacheobjdec1
       {
@@ -948,8 +948,8 @@ cacheobjdec: ID COLON INT unit /* Generic cache. Just a container for data */
       }
       ;
 
-/* ac_cache object declarations with 4 or 5 parameters */
-                 /* writemethod */
+/* ac_cache object declarations with 5 or 6 parameters */
+                 /* prefetcher */
 cacheobjdec1: COMMA cachesparm RPAREN SEMICOLON
       |  RPAREN SEMICOLON
       ;
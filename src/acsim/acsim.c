@@ -79,12 +79,16 @@ int  ACWaitFlag=1;                              //!<Indicates whether the instru
 int  ACThreading=1;                             //!<Indicates if Direct Threading Code is turned on or not
 int  ACSyscallJump=1;                           //!<Indicates if Syscall Jump Optimization is turned on or not
 int  ACForcedInline=1;                          //!<Indicates if Forced Inline in Interpretation Routines is turned on or not
-int  ACLongJmpStop=1;                           //!<Indicates if New Stop using longjmp is turned on or not
+int  ACNewStop=1;                               //!<Indicates if stop() is checked only at synchronization points
 int  ACIndexFix=0;                              //!<Indicates if Index Decode Cache Fix Optimization is turned on or not
 int  ACPCAddress=1;                             //!<Indicates if PC bounds is verified or not
 int  ACFullDecode=0;                            //!<Indicates if Full Decode Optimization is turned on or not
 int  ACCurInstrID=1;                            //!<Indicates if Current Instruction ID is save in dispatch
 int  ACPowerEnable=0;                           //!<Indicates if Power Estimation is enabled
+int  ACCacheSampling=0;                         //!<Indicates if caches model only a sample of their sets
+int  ACParallelFlag=0;                          //!<Indicates if the instruction loop runs on its own host thread
+int  ACIdleFlag=0;                              //!<Indicates if idle loops and sleeping cores are skipped
+int  ACBatchFlag=0;                             //!<Indicates if run()/run_until() entry points are generated
 
 char ACOptions[500];                            //!<Stores ArchC recognized command line options
 char *ACOptions_p = ACOptions;                  //!<Pointer used to append options in ACOptions
@@ -141,6 +145,10 @@ struct option_map option_map[] = {
   {"--full-decode"     , "-fdc","Enable Full Decode Optimization.", 0},
   {"--no-curr-instr-id", "-nci","Disable Current Instruction ID save in dispatch.", 0},
   {"--power"           , "-pw" ,"Enable Power Estimation.", 0},
+  {"--cache-sampling"  , "-csp","Model only 1/32 of the cache sets (approximate miss rates).", 0},
+  {"--parallel"        , "-par","Run each processor on its own host thread (quantum synchronized).", 0},
+  {"--idle"            , "-idl","Skip idle loops and sleeping cores to the next pending event.", 0},
+  {"--batch"           , "-bat","Generate run()/run_until() to execute the model without sc_start.", 0},
   { }
 };
 
@@ -355,8 +363,8 @@ int main(int argc, char** argv) {
               ACForcedInline = 0;
               ACOptions_p += sprintf( ACOptions_p, "%s ", argv[0]);
               break;
-            case OPLongJmpStop:
-              ACLongJmpStop = 0;
+            case OPNewStop:
+              ACNewStop = 0;
               ACOptions_p += sprintf( ACOptions_p, "%s ", argv[0]);
               break;
             case OPIndexFix:
@@ -378,6 +386,23 @@ int main(int argc, char** argv) {
             case OPPower:
               ACPowerEnable = 1;
               ACOptions_p += sprintf( ACOptions_p, "%s ", argv[0]);
+              break;
+            case OPCacheSampling:
+              ACCacheSampling = 1;
+              ACOptions_p += sprintf( ACOptions_p, "%s ", argv[0]);
+              break;
+            case OPParallel:
+              ACParallelFlag = 1;
+              ACOptions_p += sprintf( ACOptions_p, "%s ", argv[0]);
+              break;
+            case OPIdle:
+              ACIdleFlag = 1;
+              ACOptions_p += sprintf( ACOptions_p, "%s ", argv[0]);
+              break;
+            case OPBatch:
+              ACBatchFlag = 1;
+              ACOptions_p += sprintf( ACOptions_p, "%s ", argv[0]);
+              break;
             default:
               break;
           }
@@ -395,6 +420,12 @@ int main(int argc, char** argv) {
 
   if ( !ACDecCacheFlag ) ACFullDecode = 0;
 
+  /* The host threads give control back to the scheduler only in sync() */
+  if (ACParallelFlag && !ACWaitFlag) {
+    AC_ERROR("--parallel (-par) cannot be used with --no-wait (-nw).\n");
+    return EXIT_FAILURE;
+  }
+
   //Loading Configuration Variables
   ReadConfFile();
 
@@ -1096,9 +1127,6 @@ void CreateParmHeader() {
   if( HaveCycleRange )
     fprintf( output, "#define  AC_CYCLE_RANGE \t //!< Indicates that cycle range for instructions were declared.\n\n");
 
-  if( ACLongJmpStop || ACThreading )
-    fprintf( output, "#define  AC_ACTION_STOP 2\t //!< Indicates action value to stop used by longjmp.\n\n");
-
   /* parms namespace definition */
   fprintf(output, "namespace %s_parms {\n\n", project_name);
 
@@ -1540,8 +1568,8 @@ void CreateProcessorHeader() {
   extern ac_sto_list *tlm2_intr_port_list;
 
   extern ac_sto_list *tlm_intr_port_list;
-  ac_sto_list *pport;
-  extern ac_dec_instr *instr_list;
+  extern ac_sto_list *storage_list;
+  ac_sto_list *pport, *pstorage;
   char filename[256];
   char description[] = "Architecture Module header file.";
 
@@ -1608,18 +1636,6 @@ if (HaveTLM2IntrPorts) {
   if( ACDecCacheFlag ) {
     EmitDecCache(output, 1);
   }
-  if( ACWaitFlag ) {
-    for(int temp=1; temp<=5; temp++) {
-      for (ac_dec_instr *pinstr = instr_list; pinstr != NULL; pinstr = pinstr->next) {
-        if (pinstr->cycles == temp) {
-          fprintf(output, "%ssc_time time_%dcycle;\n", INDENT[1], temp);
-          break;
-        }
-      }
-    }
-    fprintf( output, "\n");
-  }
-
   fprintf( output, "public:\n\n");
 
   // POWER ESTIMATION SUPPORT
@@ -1690,6 +1706,17 @@ if (HaveTLM2IntrPorts) {
   COMMENT(INDENT[1], "Behavior execution method.");
   fprintf( output, "%svoid behavior();\n\n", INDENT[1]);
 
+  COMMENT(INDENT[1], "Instruction loop (init: first entry, not after ac_annul()).");
+  fprintf( output, "%s__attribute__((noinline)) void execute(bool init);\n\n", INDENT[1]);
+
+  if (ACBatchFlag) {
+    COMMENT(INDENT[1], "Batch execution: run the instruction loop without sc_start.");
+    fprintf( output, "%srun_exit_t run(unsigned long long max_instructions);\n",
+             INDENT[1]);
+    fprintf( output, "%srun_exit_t run_until(unsigned int pc, unsigned long long max_instructions = ~0ULL);\n\n",
+             INDENT[1]);
+  }
+
   if (ACVerboseFlag) {
     COMMENT(INDENT[1], "Verification method.");
     fprintf( output, "%svoid ac_verify();\n\n", INDENT[1]);
@@ -1758,8 +1785,27 @@ if (HaveTLM2IntrPorts) {
   fprintf( output, "%sac_id.write(globalId++);\n", INDENT[2]);
 
 
-  if (ACWaitFlag)
-    fprintf(output, "%sset_proc_freq(1000/module_period_ns);\n", INDENT[2]);
+  if (ACWaitFlag) {
+    /* Interactions seen by the adaptive quantum */
+    for (pstorage = storage_list; pstorage != NULL; pstorage = pstorage->next)
+      if (pstorage->type == TLM2_PORT)
+        fprintf(output, "%sadd_interaction_counter(%s.transactions);\n",
+                INDENT[2], pstorage->name);
+    for (pport = tlm2_intr_port_list; pport != NULL; pport = pport->next)
+      fprintf(output, "%sadd_interaction_counter(%s.interrupts);\n",
+              INDENT[2], pport->name);
+  }
+
+  /* Interrupts are queued and drained before the next instruction */
+  for (pport = tlm2_intr_port_list; pport != NULL; pport = pport->next)
+    fprintf(output, "%sadd_intr_source(%s);\n", INDENT[2], pport->name);
+
+  if (ACParallelFlag)
+    fprintf(output, "%sset_parallel();\n", INDENT[2]);
+
+  /* Only the threaded decoder cache catches jumps to lazy binding traps */
+  if (ACThreading && ACABIFlag && ACDecCacheFlag)
+    fprintf(output, "%sac_dyn_loader.set_lazy_binding(true);\n", INDENT[2]);
 
   fprintf( output, "%s}\n\n", INDENT[1]);  //end constructor
 
@@ -1801,11 +1847,8 @@ if (HaveTLM2IntrPorts) {
              INDENT[1], project_name);
   }
 
-  if (ACWaitFlag) {
-    fprintf( output, "%svoid set_proc_freq(unsigned int proc_freq);\n\n", INDENT[1]);
-  }
-
   fprintf( output, "%sunsigned get_ac_pc();\n\n", INDENT[1]);
+  fprintf( output, "%svirtual double get_modeled_time_ns();\n\n", INDENT[1]);
   fprintf( output, "%svoid set_ac_pc( unsigned int value );\n\n", INDENT[1]);
   fprintf( output, "%svirtual void PrintStat();\n\n", INDENT[1]);
   fprintf( output, "%svoid init(int ac, char* av[]);\n\n", INDENT[1]);
@@ -2062,7 +2105,6 @@ void CreateProcessorImpl() {
     extern int HaveMemHier, ACGDBIntegrationFlag, largest_format_size;
     ac_sto_list *pstorage;
 
-    extern ac_dec_instr *instr_list;
 
     char* filename;
     FILE* output;
@@ -2086,6 +2128,33 @@ void CreateProcessorImpl() {
         EmitDispatch(output, 0);
 
     fprintf( output, "void %s::behavior() {\n\n", project_name);
+
+    /* Parallel execution: the SC_THREAD hands the loop to a host thread */
+    if (ACParallelFlag) {
+        fprintf(output, "%sif (is_parallel() && !on_host_thread()) {\n", INDENT[1]);
+        fprintf(output, "%srun_parallel();\n", INDENT[2]);
+        fprintf(output, "%sreturn;\n", INDENT[2]);
+        fprintf(output, "%s}\n\n", INDENT[1]);
+    }
+
+    /* Delayed program loading */
+    fprintf(output, "%sif (has_delayed_load) {\n", INDENT[1]);
+    fprintf(output, "%s%s_mport.load(delayed_load_program);\n", INDENT[2], load_device->name);
+    fprintf(output, "%sac_pc = ac_start_addr;\n", INDENT[2]);
+    fprintf(output, "%shas_delayed_load = false;\n", INDENT[2]);
+    fprintf(output, "%s}\n\n", INDENT[1]);
+
+    /* Longjmp of ac_annul(). The setjmp stays out of execute(), so the
+       instruction loop keeps its registers; stop() needs no longjmp. */
+    fprintf( output, "%sif (setjmp(ac_env) == 0)\n", INDENT[1]);
+    fprintf( output, "%sexecute(true);\n", INDENT[2]);
+    fprintf( output, "%selse\n", INDENT[1]);
+    fprintf( output, "%sexecute(false);\n", INDENT[2]);
+
+    fprintf( output, "%s} // behavior()\n\n", INDENT[0]);
+
+    fprintf( output, "void %s::execute(bool init) {\n\n", project_name);
+
     if( ACDebugFlag ){
         fprintf( output, "%sextern bool ac_do_trace;\n", INDENT[1]);
         fprintf( output, "%sextern ofstream trace_file;\n", INDENT[1]);
@@ -2096,13 +2165,6 @@ void CreateProcessorImpl() {
     else
         fprintf( output, "%sunsigned ins_id;\n", INDENT[1]);
 
-    /* Delayed program loading */
-    fprintf(output, "%sif (has_delayed_load) {\n", INDENT[1]);
-    fprintf(output, "%s%s_mport.load(delayed_load_program);\n", INDENT[2], load_device->name);
-    fprintf(output, "%sac_pc = ac_start_addr;\n", INDENT[2]);
-    fprintf(output, "%shas_delayed_load = false;\n", INDENT[2]);
-    fprintf(output, "%s}\n\n", INDENT[1]);
-
     /*if( HaveMemHier ) {
       fprintf( output, "%sif( ac_wait_sig ) {\n", INDENT[1]);
       fprintf( output, "%sreturn;\n", INDENT[2]);
@@ -2110,6 +2172,11 @@ void CreateProcessorImpl() {
       }*/
 
     if( ACFullDecode ) {
+        /* run() resumes the loop: decode only before the first instruction */
+        if (ACBatchFlag)
+            fprintf(output, "%sif (init && ac_instr_counter == 0)\n", INDENT[1]);
+        else
+            fprintf(output, "%sif (init)\n", INDENT[1]);
         fprintf(output, "%sfor (decode_pc = ac_pc; decode_pc < dec_cache_size; decode_pc += %d) {\n",
                 INDENT[1], largest_format_size / 8);
         EmitDecodification(output, 2);
@@ -2117,6 +2184,8 @@ void CreateProcessorImpl() {
     }
 
     if ( ACThreading && ACABIFlag && ACDecCacheFlag) {
+        /* Lazy PLT slots get the routine of the ac_rtld_bind entry */
+        fprintf( output, "%svoid *rtld_bind_rot;\n", INDENT[1]);
         fprintf( output, "%s#define AC_SYSC(NAME,LOCATION) \\\n", INDENT[1]);
         fprintf( output, "%sinstr_dec = (DEC_CACHE + (LOCATION", INDENT[1]);
         if( ACIndexFix )
@@ -2127,16 +2196,33 @@ void CreateProcessorImpl() {
             fprintf( output, "%sinstr_dec->valid = true; \\\n", INDENT[1]);
 
         fprintf( output, "%sinstr_dec->id = 0; \\\n", INDENT[1]);
-        fprintf( output, "%sinstr_dec->end_rot = &&Sys_##LOCATION;\n\n", INDENT[1]);
+        fprintf( output, "%sinstr_dec->end_rot = &&Sys_##LOCATION; \\\n", INDENT[1]);
+        fprintf( output, "%sif (!strcmp(#NAME, \"ac_rtld_bind\")) rtld_bind_rot = &&Sys_##LOCATION;\n\n",
+                 INDENT[1]);
 
         fprintf( output, "%s#include <ac_syscall.def>\n", INDENT[1]);
         fprintf( output, "%s#undef AC_SYSC\n\n", INDENT[1]);
-    }
 
-    // Longjmp of ac_annul_sig and ac_stop_flag
-    fprintf( output, "%sint action = setjmp(ac_env);\n", INDENT[1]);
-    if (ACLongJmpStop || ACThreading)
-        fprintf( output, "%sif (action == AC_ACTION_STOP) return;\n\n", INDENT[1]);
+        /* Lazy PLT slots of the dynamic linker jump to these traps */
+        if (ACBatchFlag)
+            fprintf(output, "%sif (init && ac_instr_counter == 0)\n", INDENT[1]);
+        else
+            fprintf(output, "%sif (init)\n", INDENT[1]);
+        fprintf( output, "%sfor (unsigned lazy_pc = ac_dyn_loader.get_lazy_begin(); "
+                 "lazy_pc < ac_dyn_loader.get_lazy_end(); lazy_pc += AC_RTLD_LAZY_STRIDE) {\n",
+                 INDENT[2]);
+        fprintf( output, "%sinstr_dec = (DEC_CACHE + (lazy_pc", INDENT[3]);
+        if( ACIndexFix )
+            fprintf( output, " / %d", largest_format_size / 8);
+        fprintf( output, "));\n");
+
+        if ( !ACFullDecode )
+            fprintf( output, "%sinstr_dec->valid = true;\n", INDENT[3]);
+
+        fprintf( output, "%sinstr_dec->id = 0;\n", INDENT[3]);
+        fprintf( output, "%sinstr_dec->end_rot = rtld_bind_rot;\n", INDENT[3]);
+        fprintf( output, "%s}\n\n", INDENT[2]);
+    }
 
     //Emitting processor behavior method implementation.
     if( ACThreading )
@@ -2144,7 +2230,7 @@ void CreateProcessorImpl() {
     else
         EmitProcessorBhv(output, 1);
 
-    fprintf( output, "%s} // behavior()\n\n", INDENT[0]);
+    fprintf( output, "%s} // execute()\n\n", INDENT[0]);
 
     //Emitting Verification Method.
     if (ACVerboseFlag) {
@@ -2288,10 +2374,25 @@ void CreateProcessorImpl() {
     fprintf(output, "%sac_stop_flag = 1;\n", INDENT[1]);
     fprintf(output, "%sac_exit_status = status;\n", INDENT[1]);
     fprintf(output, "%sset_stopped();\n", INDENT[1]);
-    if (ACLongJmpStop)
-        fprintf(output, "%slongjmp(ac_env, AC_ACTION_STOP);\n", INDENT[1]);
     fprintf(output, "}\n\n");
 
+    /* run() and run_until() */
+    if (ACBatchFlag) {
+        fprintf(output, "//Execute at most max_instructions without sc_start\n");
+        fprintf(output, "ac_module::run_exit_t %s::run(unsigned long long max_instructions) {\n",
+                project_name);
+        fprintf(output, "%sreturn run_batch(ac_instr_counter, max_instructions, ~0U);\n",
+                INDENT[1]);
+        fprintf(output, "}\n\n");
+
+        fprintf(output, "//Execute until the instruction at pc is reached\n");
+        fprintf(output, "ac_module::run_exit_t %s::run_until(unsigned int pc, unsigned long long max_instructions) {\n",
+                project_name);
+        fprintf(output, "%sreturn run_batch(ac_instr_counter, max_instructions, pc);\n",
+                INDENT[1]);
+        fprintf(output, "}\n\n");
+    }
+
     /* Program loading functions */
     /* load() */
     fprintf(output, "void %s::load(char* program) {\n", project_name);
@@ -2334,6 +2435,19 @@ void CreateProcessorImpl() {
     fprintf(output, "%sreturn ac_pc;\n", INDENT[1]);
     fprintf(output, "}\n\n");
 
+    /* get_modeled_time_ns() */
+    fprintf(output, "// Modeled time of this processor in ns (--virtual-time)\n");
+    fprintf(output, "double %s::get_modeled_time_ns() {\n", project_name);
+    if (ACWaitFlag) {
+      /* Kernel time, plus the local time and cycles not yet synchronized */
+      fprintf(output, "%sreturn (sc_time_stamp() + get_local_time()).to_seconds() * 1e9;\n",
+              INDENT[1]);
+    }
+    else
+      fprintf(output, "%sreturn (ac_cycle_counter ? ac_cycle_counter : ac_instr_counter) *\n"
+              "%s       (double) module_period_ns;\n", INDENT[1], INDENT[1]);
+    fprintf(output, "}\n\n");
+
     /* set_ac_pc() */
     fprintf(output, "// Assigns value to ac_pc\n");
     fprintf(output, "void %s::set_ac_pc(unsigned int value) {\n", project_name);
@@ -2345,6 +2459,14 @@ void CreateProcessorImpl() {
     fprintf(output, "void %s::PrintStat() {\n", project_name);
     fprintf(output, "%sac_arch<%s_parms::ac_word, %s_parms::ac_Hword>::PrintStat();\n",
             INDENT[1], project_name, project_name);
+    if (ACWaitFlag)
+        fprintf(output, "%sPrintQuantumStat();\n", INDENT[1]);
+    if (ACIdleFlag)
+        fprintf(output, "%sPrintIdleStat();\n", INDENT[1]);
+    if (HaveTLM2IntrPorts)
+        fprintf(output, "%sPrintIntrStat();\n", INDENT[1]);
+    if (ACABIFlag)
+        fprintf(output, "%sISA.syscall.PrintSyscallStat();\n", INDENT[1]);
 
 
 
@@ -2367,24 +2489,6 @@ void CreateProcessorImpl() {
 
     fprintf(output, "}\n\n");
 
-    if (ACWaitFlag) {
-        /* set_proc_freq() */
-        fprintf(output, "// Assigns value to processor frequency and updates cycle time values\n");
-        fprintf(output, "void %s::set_proc_freq(unsigned int proc_freq) {\n", project_name);
-        fprintf(output, "%sac_module::set_proc_freq(proc_freq);\n", INDENT[1]);
-
-        for(int cycles=1; cycles<=5; cycles++) {
-            for (ac_dec_instr *pinstr = instr_list; pinstr != NULL; pinstr = pinstr->next) {
-                if (pinstr->cycles == cycles) {
-                    fprintf(output, "%stime_%dcycle=sc_time(%d*module_period_ns, SC_NS);\n", INDENT[1], cycles, cycles);
-                    break;
-                }
-            }
-        }
-
-        fprintf(output, "}\n\n");
-
-    }
     /* GDB enable method */
     if (ACGDBIntegrationFlag) {
         fprintf(output, "// Enables GDB\n");
@@ -3355,9 +3459,10 @@ void CreateMakefile(){
 
   fprintf( output, " %s", OTHER_FLAGS);
 
-  fprintf( output, "CFLAGS := $(DEBUG) $(OPT) $(OTHER) %s %s\n",
+  fprintf( output, "CFLAGS := $(DEBUG) $(OPT) $(OTHER) %s %s %s\n",
            (ACGDBIntegrationFlag) ? "-DUSE_GDB" : "",
-           (ACPowerEnable) ? "-DPOWER_SIM=\\\"$(PWD)/powersc\\\"" : "");
+           (ACPowerEnable) ? "-DPOWER_SIM=\\\"$(PWD)/powersc\\\"" : "",
+           (ACCacheSampling) ? "-DCACHE_SAMPLE_RATIO=32" : "");
 
   fprintf( output, "\nTARGET := %s\n\n", project_name);
 
@@ -3540,7 +3645,7 @@ void CreateMakefile(){
   \brief Used by EmitProcessorBhv and EmitDispatch functions      */
 /***************************************/
 void EmitUpdateMethod( FILE *output, int base_indent ) {
-  extern int HaveMemHier;
+  extern int HaveMemHier, HaveTLM2IntrPorts;
   extern ac_sto_list *storage_list;
 
   ac_sto_list *pstorage;
@@ -3550,12 +3655,12 @@ void EmitUpdateMethod( FILE *output, int base_indent ) {
     COMMENT(INDENT[base_indent],"Updating Regs for behavioral simulation.");
   }
 
-  if (!ACLongJmpStop) {
-    fprintf( output, "%sif (ac_stop_flag) ", INDENT[base_indent]);
-    if (ACThreading)
-      fprintf(output, "longjmp(ac_env, AC_ACTION_STOP);\n\n");
-    else
-      fprintf(output, "return;\n\n");
+  /* With the new stop, set_stopped() zeroes the cycle budget and the
+     flag is tested only when need_sync() holds */
+  if (!ACNewStop || !ACWaitFlag) {
+    fprintf( output, "%sif (ac_stop_flag)\n", INDENT[base_indent]);
+    EmitLoopExit(output, base_indent + 1);
+    fprintf( output, "\n");
   }
 
   if( ACDelayFlag ){
@@ -3585,11 +3690,40 @@ void EmitUpdateMethod( FILE *output, int base_indent ) {
     }
   }*/
 
+  /* Interrupts queued by the TLM2 interrupt ports (add_intr_source()) */
+  if (HaveTLM2IntrPorts)
+    fprintf(output, "%spoll_interrupts();\n", INDENT[base_indent]);
+
+  if (ACIdleFlag) {
+    /* Idle loop of the guest or wait for interrupt (ac_sleep()) */
+    fprintf(output, "%sif (idle_loop(ac_pc) || ac_sleep_sig) {\n", INDENT[base_indent]);
+    fprintf(output, "%ssleep(wake, ac_sleep_sig ? AC_SLEEP_WFI : AC_SLEEP_IDLE);\n",
+            INDENT[base_indent + 1]);
+    fprintf(output, "%sac_sleep_sig = 0;\n", INDENT[base_indent + 1]);
+    fprintf(output, "%s}\n", INDENT[base_indent]);
+  }
+
   if (ACWaitFlag) {
-    fprintf(output, "%sif (ac_qk.need_sync()) {\n", INDENT[base_indent]);
-    fprintf(output, "%sac_qk.sync();\n", INDENT[base_indent + 1]);
+    fprintf(output, "%sif (need_sync()) {\n", INDENT[base_indent]);
+    if (ACNewStop) {
+      fprintf(output, "%sif (ac_stop_flag)\n", INDENT[base_indent + 1]);
+      EmitLoopExit(output, base_indent + 2);
+    }
+    fprintf(output, "%ssync();\n", INDENT[base_indent + 1]);
+    if (ACParallelFlag) {
+      /* End of simulation: the host thread leaves the loop */
+      fprintf(output, "%sif (par_exiting())\n", INDENT[base_indent + 1]);
+      EmitLoopExit(output, base_indent + 2);
+    }
     fprintf(output, "%s}\n", INDENT[base_indent]);
   }
+
+  if (ACBatchFlag) {
+    /* Back to the caller of run() */
+    fprintf(output, "%sif (run_active && run_done(ac_pc, ac_instr_counter))\n",
+            INDENT[base_indent]);
+    EmitLoopExit(output, base_indent + 1);
+  }
 }
 
 
@@ -3691,11 +3825,7 @@ void EmitDecodification( FILE *output, int base_indent) {
     fprintf( output, "%scerr << \"PC = \" << hex << ac_pc << dec << endl;\n",
             INDENT[base_indent+1]);
     fprintf( output, "%sstop();\n", INDENT[base_indent+1]);
-    if (ACThreading)
-      fprintf(output, "%slongjmp(ac_env, AC_ACTION_STOP);\n",
-              INDENT[base_indent + 1]);
-    else
-      fprintf( output, "%sreturn;\n", INDENT[base_indent+1]);
+    EmitLoopExit(output, base_indent + 1);
     fprintf( output, "%s}\n\n", INDENT[base_indent]);
   }
 }
@@ -3860,12 +3990,8 @@ void EmitInstrExec( FILE *output, int base_indent){
         }
         fprintf(output, ");\n");
 
-        if( ACWaitFlag ) {
-          if (pinstr->cycles <= 5)
-            fprintf(output, "%sac_qk.inc(time_%dcycle);\n", INDENT[base_indent + 1], pinstr->cycles);
-          else
-            fprintf(output, "%sac_qk.inc(sc_time(module_period_ns*%d, SC_NS));\n", INDENT[base_indent + 1], pinstr->cycles);
-        }
+        if( ACWaitFlag )
+          fprintf(output, "%squantum_cycles += %d;\n", INDENT[base_indent + 1], pinstr->cycles);
 
         if( ACThreading )
             fprintf(output, "%sgoto *dispatch();\n\n", INDENT[base_indent + 1]);
@@ -3873,6 +3999,12 @@ void EmitInstrExec( FILE *output, int base_indent){
             fprintf(output, "%sbreak;\n", INDENT[base_indent]);
     }
 
+    if( ACThreading ) {
+        fprintf(output, "%sI_Exit: // Leaves the instruction loop (see EmitLoopExit)\n",
+                INDENT[base_indent]);
+        fprintf(output, "%sreturn;\n", INDENT[base_indent + 1]);
+    }
+
     if( !ACThreading ) {
         fprintf(output, "%s} // switch (ins_id)\n", INDENT[base_indent]);
 
@@ -3906,11 +4038,7 @@ void EmitFetchInit( FILE *output, int base_indent){
     fprintf( output, "%scerr << \"ArchC: Address out of bounds (pc=0x\" << hex << ac_pc << \").\" << endl;\n",
             INDENT[base_indent+1]);
     fprintf( output, "%sstop();\n", INDENT[base_indent+1]);
-    if (ACThreading)
-      fprintf(output, "%slongjmp(ac_env, AC_ACTION_STOP);\n",
-              INDENT[base_indent + 1]);
-    else
-      fprintf( output, "%sreturn;\n", INDENT[base_indent+1]);
+    EmitLoopExit(output, base_indent + 1);
     fprintf( output, "%s}\n", INDENT[base_indent]);
   }
 }
@@ -4298,11 +4426,7 @@ void EmitDecCacheAt(FILE *output, int base_indent) {
             INDENT[base_indent + 2]);
     fprintf(output, "%sstop();\n", INDENT[base_indent + 2]);
 
-    if (ACThreading)
-      fprintf(output, "%slongjmp(ac_env, AC_ACTION_STOP);\n",
-              INDENT[base_indent + 2]);
-    else
-      fprintf(output, "%sreturn;\n", INDENT[base_indent + 2]);
+    EmitLoopExit(output, base_indent + 2);
   }
 
   fprintf(output, "%s}\n", INDENT[base_indent]);
@@ -4329,7 +4453,19 @@ void EmitDispatch(FILE *output, int base_indent) {
     fprintf(output, "%s/* wake - this event will happen in the moment the processor receives and            */\n",INDENT[base_indent]);
     fprintf(output, "%s/* interrupt with code AWAKE (1)                                                     */\n",INDENT[base_indent]);
     fprintf(output, "%s/*************************************************************************************/\n",INDENT[base_indent]);
-    fprintf(output, "%sif (intr_reg.read() == 0)  wait(wake);\n",INDENT[base_indent]);
+    /* sleep() may return early (end of a quantum, other interrupts) */
+    fprintf(output, "%swhile (intr_reg.read() == 0) {\n", INDENT[base_indent]);
+    fprintf(output, "%ssleep(wake);\n", INDENT[base_indent + 1]);
+    fprintf(output, "%sif (%sac_stop_flag)\n", INDENT[base_indent + 1],
+            ACParallelFlag ? "par_exiting() || " : "");
+    EmitLoopExit(output, base_indent + 2);
+    if (ACBatchFlag) {
+      /* A sleeping batch goes back to the caller of run() */
+      fprintf(output, "%sif (run_active && run_done(ac_pc, ac_instr_counter))\n",
+              INDENT[base_indent + 1]);
+      EmitLoopExit(output, base_indent + 2);
+    }
+    fprintf(output, "%s}\n", INDENT[base_indent]);
   }
 
 
@@ -4497,12 +4633,34 @@ void EmitVetLabelAt(FILE *output, int base_indent) {
     }
     fprintf(output, "&&I_%s", pinstr->name);
   }
-  fprintf(output, "};\n\n");
+  fprintf(output, ", &&I_Exit};\n\n");
 
   fprintf(output, "%sIntRoutine = vet;\n\n", INDENT[base_indent]);
 }
 
 
+/**************************************/
+/*!  Emits the statement that leaves the instruction
+ * loop. With threading it runs inside dispatch(), which
+ * returns the address of I_Exit, the last entry of vet[].
+  \brief Used by EmitUpdateMethod, EmitFetchInit,
+  EmitDecodification and EmitDecCacheAt functions */
+/***************************************/
+void EmitLoopExit(FILE *output, int base_indent) {
+  extern ac_dec_instr *instr_list;
+  ac_dec_instr *pinstr;
+  unsigned exit_id = 1;
+
+  if (ACThreading) {
+    for (pinstr = instr_list; pinstr != NULL; pinstr = pinstr->next)
+      exit_id++;
+    fprintf(output, "%sreturn IntRoutine[%d];\n", INDENT[base_indent], exit_id);
+  }
+  else
+    fprintf(output, "%sreturn;\n", INDENT[base_indent]);
+}
+
+
 ////////////////////////////////////
 // Utility Functions              //
 ////////////////////////////////////
@@ -4680,6 +4838,24 @@ void ParseCache(ac_sto_list *cache_in) {
             exit(EXIT_FAILURE);
         }
     }
+
+    // 6th parameter (optional)
+    p = p->next;
+    if (p == NULL || !strcmp(p->str, "none") || !strcmp(p->str, "NONE")) {
+        cache_out->prefetcher = NoPrefetcher;
+    } else if (!strcmp(p->str, "nextline") || !strcmp(p->str, "NEXTLINE")) {
+        cache_out->prefetcher = NextLine;
+    } else if (!strcmp(p->str, "stride") || !strcmp(p->str, "STRIDE")) {
+        cache_out->prefetcher = Stride;
+    } else if (!strcmp(p->str, "stream") || !strcmp(p->str, "STREAM")) {
+        cache_out->prefetcher = Stream;
+    } else {
+        AC_ERROR("Invalid parameter in cache declaration: %s\n",
+                 cache_in->name);
+        printf("The sixth parameter must be a valid prefetcher: \"nextline\","
+               " \"stride\", \"stream\" or \"none\".\n");
+        exit(EXIT_FAILURE);
+    }
 }
 
 void TLMMemoryClassDeclaration(ac_sto_list * memory)
@@ -4723,15 +4899,22 @@ void CacheClassDeclaration(ac_sto_list * storage)
     }
     storage->class_declaration = malloc(s);
 
+    // The prefetcher comes after the (default) address type
+    char prefetcher[64] = "";
+    if (cache->prefetcher != NoPrefetcher)
+        snprintf(prefetcher, sizeof(prefetcher), ", unsigned, %s",
+                 PrefetcherName[cache->prefetcher]);
+
     // FIXME: Can I set "ac_memport" directly here instead of
     // cache->higher->class_declaration?
     int r = snprintf(
         storage->class_declaration, s, "%s<%d, %d, %d, %s_parms::ac_word, "
                                        "ac_memport<%s_parms::ac_word, "
-                                       "%s_parms::ac_Hword>, %s>",
+                                       "%s_parms::ac_Hword>, %s%s>",
         CacheName[cache->type], cache->block_count / cache->associativity,
         cache->block_size, cache->associativity, project_name, project_name,
-        project_name, ReplacementPolicyName[cache->replacement_policy]);
+        project_name, ReplacementPolicyName[cache->replacement_policy],
+        prefetcher);
     if (r >= s)
         abort();
 }
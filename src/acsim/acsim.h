@@ -118,12 +118,16 @@ enum _ac_cmd_options {
   OPDTC,
   OPSysJump,
   OPForcedInline,
-  OPLongJmpStop,
+  OPNewStop,
   OPIndexFix,
   OPPCAddress,
   OPFullDecode,
   OPCurInstrID,
   OPPower,
+  OPCacheSampling,
+  OPParallel,
+  OPIdle,
+  OPBatch,
   ACNumberOfOptions,
 };
 
@@ -156,6 +160,20 @@ static const char *ReplacementPolicyName[] = {
   [None] = "ac_fifo_replacement_policy" // placeholder
 };
 
+enum CachePrefetcher {
+  NoPrefetcher,
+  NextLine,
+  Stride,
+  Stream
+};
+
+static const char *PrefetcherName[] = {
+  [NoPrefetcher] = "ac_no_prefetcher",
+  [NextLine] = "ac_next_line_prefetcher",
+  [Stride] = "ac_stride_prefetcher",
+  [Stream] = "ac_stream_prefetcher"
+};
+
 
 struct CacheObject {
   enum CacheType type;
@@ -163,6 +181,7 @@ struct CacheObject {
   unsigned block_size;
   unsigned associativity;
   enum CacheReplacementPolicy replacement_policy;
+  enum CachePrefetcher prefetcher;
 };
 
 
@@ -226,6 +245,7 @@ void EmitDecCache(FILE *output, int base_indent);
 void EmitDecCacheAt(FILE *output, int base_indent);                                //!< Emits a Decoder Cache Attribution
 void EmitDispatch(FILE *output, int base_indent);                                  //!< Emits the Dispatch Function used by Threading
 void EmitVetLabelAt(FILE *output, int base_indent);                                //!< Emits the Vector with Address of the Interpretation Routines used by Threading
+void EmitLoopExit(FILE *output, int base_indent);                                  //!< Emits the statement that leaves the instruction loop
 //@}
 
 /** @defgroup utilitfunc Utility Functions